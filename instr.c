@@ -5,76 +5,584 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "misc.h"
 
 #include "instr.h"
 
-//prints a single instruction
-static void print_tom_instr(instruction_t* instr) {
+int instr_print_commit = 0;
+
+/* THE TOMASULO TABLE */
+
+int instr_table_format = INSTR_TABLE_TEXT;
+char* instr_table_path = NULL;
+int instr_table_first = 1;
+int instr_table_last = INT_MAX;
+int instr_table_sample = 1;
+int instr_table_disasm_cache = 1;
+
+#define INSTR_TABLE_MAGIC   "TOMTABLE"
+#define INSTR_TABLE_VERSION 1
+
+//a binary table is this header followed by one instr_table_record_t per row
+typedef struct instr_table_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+}instr_table_header_t;
+
+typedef struct instr_table_record
+{
+  uint64_t pc;
+  uint32_t index;
+  uint16_t op;
+  uint16_t pad;
+  int32_t dispatch;
+  int32_t issue;
+  int32_t execute;
+  int32_t cdb;
+  int32_t commit;     //0 without a reorder buffer
+  uint32_t unused;    //0; keeps the record a multiple of 8 bytes
+}instr_table_record_t;
+
+//rows are formatted into a buffer of our own and written out a megabyte at a time
+#define TABLE_BUFFER_SIZE (1 << 20)
+#define TABLE_ROW_MAX     256
+
+static FILE* table_file = NULL;    //NULL until the first row
+static char* table_buffer = NULL;
+static size_t table_used = 0;
+
+//disassembly, cached by pc; an entry is only used if the instruction word matches too
+#define DISASM_CACHE_SIZE 4096
+#define DISASM_TEXT_MAX   (TABLE_ROW_MAX - 64)
+
+typedef struct disasm_entry
+{
+  md_addr_t pc;
+  md_inst_t inst;
+  int length;         //of the text, 0 if the entry is empty
+  char text[DISASM_TEXT_MAX];
+}disasm_entry_t;
+
+static disasm_entry_t* disasm_cache = NULL;
+static FILE* disasm_stream = NULL;   //md_print_insn writes into disasm_text through it
+static char disasm_text[DISASM_TEXT_MAX + 1];
+
+static void flush_table_buffer(void) {
+  if (table_used && fwrite(table_buffer, 1, table_used, table_file) != table_used)
+     fatal("cannot write the Tomasulo table");
+  table_used = 0;
+}
+
+//room for a row at the end of the buffer
+static char* table_row(void) {
+  if (table_used > TABLE_BUFFER_SIZE - TABLE_ROW_MAX)
+     flush_table_buffer();
+  return table_buffer + table_used;
+}
+
+//starts the table: opens its file and writes the header
+void open_instr_table(void) {
+
+  if (table_file)
+     return;
+  if (instr_table_path) {
+     table_file = fopen(instr_table_path, instr_table_format == INSTR_TABLE_BINARY ? "wb" : "w");
+     if (!table_file)
+        fatal("cannot open table file `%s' for writing", instr_table_path);
+  }
+  else
+     table_file = stdout;
+  table_buffer = malloc(TABLE_BUFFER_SIZE);
+  if (!table_buffer)
+     fatal("out of virtual memory");
+
+  if (instr_table_format == INSTR_TABLE_BINARY) {
+     instr_table_header_t header;
+     memset(&header, 0, sizeof(header));
+     memcpy(header.magic, INSTR_TABLE_MAGIC, sizeof(header.magic));
+     header.version = INSTR_TABLE_VERSION;
+     header.record_size = sizeof(instr_table_record_t);
+     memcpy(table_row(), &header, sizeof(header));
+     table_used += sizeof(header);
+  }
+  else {
+     memcpy(table_row(), "TOMASULO TABLE\n", 15);
+     table_used += 15;
+  }
+}
+
+//the disassembly of an instruction; returns its length
+static int disassemble(const instruction_t* instr, const char** text) {
+
+  disasm_entry_t* entry = NULL;
+  if (instr_table_disasm_cache) {
+     if (!disasm_cache) {
+        disasm_cache = calloc(DISASM_CACHE_SIZE, sizeof(disasm_entry_t));
+        if (!disasm_cache)
+           fatal("out of virtual memory");
+     }
+     entry = &disasm_cache[(instr->pc / sizeof(md_inst_t)) & (DISASM_CACHE_SIZE - 1)];
+     if (entry->length && entry->pc == instr->pc
+         && !memcmp(&entry->inst, &instr->inst, sizeof(md_inst_t))) {
+        *text = entry->text;
+        return entry->length;
+     }
+  }
+
+  if (!disasm_stream) {
+     disasm_stream = fmemopen(disasm_text, sizeof(disasm_text), "w");
+     if (!disasm_stream)
+        fatal("cannot open a memory stream for the disassembly");
+  }
+  rewind(disasm_stream);
+  md_print_insn(instr->inst, instr->pc, disasm_stream);
+  fflush(disasm_stream);
+  int length = MIN((int)ftell(disasm_stream), DISASM_TEXT_MAX);
+
+  if (entry) {
+     entry->pc = instr->pc;
+     entry->inst = instr->inst;
+     entry->length = length;
+     memcpy(entry->text, disasm_text, length);
+  }
+  *text = disasm_text;
+  return length;
+}
+
+//writes a tab and the number
+static char* put_field(char* out, int value) {
+  char digits[12];
+  int n = 0;
+  unsigned int v = value < 0 ? -(unsigned int)value : (unsigned int)value;
 
-  md_print_insn(instr->inst, instr->pc, stdout);
-  myfprintf(stdout, "\t%d\t%d\t%d\t%d\n", 
-	    instr->tom_dispatch_cycle,
-	    instr->tom_issue_cycle,
-	    instr->tom_execute_cycle,
-	    instr->tom_cdb_cycle);
+  *out++ = '\t';
+  if (value < 0)
+     *out++ = '-';
+  do {
+     digits[n++] = '0' + v % 10;
+     v /= 10;
+  } while (v);
+  while (n)
+     *out++ = digits[--n];
+  return out;
 }
 
+//prints a single instruction as a row of the Tomasulo table, unless the filter leaves it out
+void print_tom_instr(instruction_t* instr) {
+
+  if (instr->index < instr_table_first || instr->index > instr_table_last
+      || (instr->index - instr_table_first) % instr_table_sample != 0)
+     return;
+  if (!table_file)
+     open_instr_table();
+
+  char* row = table_row();
+  if (instr_table_format == INSTR_TABLE_BINARY) {
+     instr_table_record_t record;
+     memset(&record, 0, sizeof(record));
+     record.pc = instr->pc;
+     record.index = instr->index;
+     record.op = instr->op;
+     record.dispatch = instr->tom_dispatch_cycle;
+     record.issue = instr->tom_issue_cycle;
+     record.execute = instr->tom_execute_cycle;
+     record.cdb = instr->tom_cdb_cycle;
+     record.commit = instr->tom_commit_cycle;
+     memcpy(row, &record, sizeof(record));
+     table_used += sizeof(record);
+     return;
+  }
+
+  const char* text;
+  int length = disassemble(instr, &text);
+  memcpy(row, text, length);
+  char* out = row + length;
+  out = put_field(out, instr->tom_dispatch_cycle);
+  out = put_field(out, instr->tom_issue_cycle);
+  out = put_field(out, instr->tom_execute_cycle);
+  out = put_field(out, instr->tom_cdb_cycle);
+  if (instr_print_commit)
+     out = put_field(out, instr->tom_commit_cycle);
+  *out++ = '\n';
+  table_used += out - row;
+}
+
+//writes out the rows printed so far and ends the table
+void close_instr_table(void) {
+
+  if (!table_file)
+     return;
+  flush_table_buffer();
+  if (table_file != stdout ? fclose(table_file) != 0 : fflush(stdout) != 0)
+     fatal("cannot write the Tomasulo table");
+  table_file = NULL;
+  free(table_buffer);
+  table_buffer = NULL;
+}
 
 //prints all the instructions inside the given trace for pipeline
 void print_all_instr(instruction_trace_t* trace, int sim_num_insn) {
 
-  fprintf(stdout, "TOMASULO TABLE\n");
+  if (instr_table_format == INSTR_TABLE_NONE)
+     return;
 
-  int printed_count = 0;
-  int index = 1;
-  while (true) {
- 
-     if (1) { // if (printed_count > 9999900) {
-        print_tom_instr(&trace->table[index]);
-     }
+  //the header goes out even if the filter leaves every row out
+  open_instr_table();
 
-     printed_count++;
+  int index;
+  for (index = instr_table_first; index <= sim_num_insn && index <= instr_table_last
+       && index < trace->total_size; index += instr_table_sample) {
+     print_tom_instr(get_instr(trace, index));
+  }
+  close_instr_table();
+}
 
-     if (printed_count == sim_num_insn)
-        break;
-      
-     if (++index == INSTR_TRACE_SIZE) {
-        trace = trace->next;
-	index = 0;
-	if (trace == NULL)
-	   break;
-     }
-   }
+static void record_instr(instruction_t* instr);
+
+//register ids are stored in a byte (in instr_hot_t and in trace files)
+typedef char instr_regs_fit[MD_TOTAL_REGS <= 127 ? 1 : -1];
+
+//and opcodes in 16 bits
+typedef char instr_ops_fit[OP_MAX <= 65535 ? 1 : -1];
+
+//classifies the opcode and packs the registers the scheduler reads
+static void decode_instr_hot(const instruction_t* instr, instr_hot_t* hot) {
+
+  enum md_opcode op = instr->op;
+  int flags = 0;
+
+  //checked in the order the simulator used to test the opcode flags
+  if (op == 0 || (MD_OP_FLAGS(op) & F_TRAP))
+     hot->cls = INSTR_CLASS_SKIP;
+  else if (MD_OP_FLAGS(op) & (F_COND | F_UNCOND | F_CALL))
+     hot->cls = INSTR_CLASS_BRANCH;
+  else if (MD_OP_FLAGS(op) & F_FCOMP)
+     hot->cls = INSTR_CLASS_FP;
+  else if (MD_OP_FLAGS(op) & (F_ICOMP | F_LOAD | F_STORE))
+     hot->cls = INSTR_CLASS_INT;
+  else
+     hot->cls = INSTR_CLASS_OTHER;
+
+  if (MD_OP_FLAGS(op) & F_LOAD) flags |= INSTR_LOAD;
+  if (MD_OP_FLAGS(op) & F_STORE) flags |= INSTR_STORE;
+  if (MD_OP_FLAGS(op) & F_COND) flags |= INSTR_COND;
+  if (MD_OP_FLAGS(op) & (F_ICOMP | F_LOAD | F_FCOMP)) flags |= INSTR_CDB;
+
+  hot->flags = flags;
+  hot->op = op;
+  hot->next = 0;
+  hot->r_in[0] = instr->r_in[0];
+  hot->r_in[1] = instr->r_in[1];
+  hot->r_in[2] = instr->r_in[2];
+  hot->r_out[0] = instr->r_out[0];
+  hot->r_out[1] = instr->r_out[1];
+}
+
+//the scheduling fields of the instruction at the index, for put_instr to fill in
+static instr_hot_t* instr_hot_slot(instruction_trace_t* trace, int index) {
+  if (index < INSTR_TRACE_SIZE)
+     return &trace->hot_table[index];
+  return &trace->chunks[index >> INSTR_TRACE_SHIFT]->hot_table[index & (INSTR_TRACE_SIZE - 1)];
 }
 
 //inserts the instruction into the trace
 void put_instr(instruction_trace_t* trace, instruction_t* instr) {
 
-  while ((trace->size == INSTR_TRACE_SIZE) && (trace->next != NULL)) {
-    trace = trace->next;
+  //a new trace only has size and next set
+  if (trace->size == 0 && trace->next == NULL) {
+     trace->total_size = 0;
+     trace->chunks = NULL;
+     trace->num_chunks = 1;
+     trace->released_chunks = 0;
+     trace->last_valid = -1;
+     trace->spare = NULL;
   }
-  
-  if (trace->size == INSTR_TRACE_SIZE) {
-      
-     trace->next = malloc(sizeof(instruction_trace_t));
-     assert(trace->next != NULL);
-     //printf("trace=%p\n", trace);
-     trace = trace->next;
-     memset(trace, 0, sizeof(instruction_trace_t));
+
+  int chunk = trace->total_size >> INSTR_TRACE_SHIFT;
+  int offset = trace->total_size & (INSTR_TRACE_SIZE - 1);
+
+  if (offset == 0 && chunk > 0) {
+     //the first chunk to outgrow the embedded table starts the directory
+     if (chunk == 1) {
+        trace->max_chunks = 16;
+        trace->chunks = malloc(trace->max_chunks * sizeof(instruction_trace_t*));
+        assert(trace->chunks != NULL);
+        trace->chunks[0] = trace;
+     }
+     else if (chunk == trace->max_chunks) {
+        trace->max_chunks *= 2;
+        trace->chunks = realloc(trace->chunks, trace->max_chunks * sizeof(instruction_trace_t*));
+        assert(trace->chunks != NULL);
+     }
+
+     instruction_trace_t* next = trace->spare;
+     if (next != NULL)
+        trace->spare = NULL;
+     else {
+        next = malloc(sizeof(instruction_trace_t));
+        assert(next != NULL);
+     }
+     next->size = 0;
+     next->next = NULL;
+     trace->chunks[chunk] = next;
+     if (chunk - 1 >= trace->released_chunks)
+        trace->chunks[chunk - 1]->next = next;
+     else
+        trace->next = next;
+     trace->num_chunks++;
+  }
+
+  instruction_trace_t* last = chunk == 0 ? trace : trace->chunks[chunk];
+  last->table[offset] = *instr;
+  last->size++;
+  trace->total_size++;
+
+  instr_hot_t* hot = instr_hot_slot(trace, trace->total_size - 1);
+  decode_instr_hot(instr, hot);
+
+  //a front end that does not fill in mem_addr makes every load alias every store in the
+  //load/store queue, and every access hit the same cache line
+  static int warned_mem_addr = 0;
+  if ((hot->flags & (INSTR_LOAD | INSTR_STORE)) && instr->mem_addr == 0 && !warned_mem_addr) {
+     warn("instruction %d is a load or store without an effective address (mem_addr); "
+          "the load/store queue and data cache statistics will be wrong", instr->index);
+     warned_mem_addr = 1;
+  }
+
+  //a control transfer was taken if this instruction does not follow it
+  if (trace->total_size >= 2) {
+     instr_hot_t* prev = instr_hot_slot(trace, trace->total_size - 2);
+     if (prev->cls == INSTR_CLASS_BRANCH
+         && get_instr(trace, trace->total_size - 2)->pc + sizeof(md_inst_t) != instr->pc)
+        prev->flags |= INSTR_TAKEN;
   }
-  trace->table[trace->size++] = *instr;
-} 
+
+  //link the previous instruction that is not skipped to this one, so fetch can jump over the gap
+  if (hot->cls != INSTR_CLASS_SKIP) {
+     int gap = trace->total_size - 1 - trace->last_valid;
+     if (trace->last_valid >= 0 && gap <= UINT8_MAX)
+        instr_hot_slot(trace, trace->last_valid)->next = gap;
+     trace->last_valid = trace->total_size - 1;
+  }
+
+  if (instr_record_path != NULL)
+     record_instr(instr);
+}
 
 //gets the instruction at the index, from the trace
 instruction_t* get_instr(instruction_trace_t* trace, int index) {
 
-  while (index >= INSTR_TRACE_SIZE) {
-     index -= INSTR_TRACE_SIZE;
-     trace = trace->next;
+  assert(index >= 0 && index < trace->total_size);
+
+  if (index < INSTR_TRACE_SIZE)
+     return &trace->table[index];
+
+  assert((index >> INSTR_TRACE_SHIFT) >= trace->released_chunks);
+  return &trace->chunks[index >> INSTR_TRACE_SHIFT]->table[index & (INSTR_TRACE_SIZE - 1)];
+}
 
-     assert(trace != NULL);
+//drops every instruction before the index from the trace; they can no longer be read.
+//The first chunk stays, linked to the oldest chunk that is left
+void release_instr(instruction_trace_t* trace, int index) {
+
+  //nothing to free until the trace outgrows the first chunk
+  if (trace->total_size <= INSTR_TRACE_SIZE)
+     return;
+
+  int last = MIN(index, trace->total_size) >> INSTR_TRACE_SHIFT;
+  if (trace->released_chunks == 0)
+     trace->released_chunks = 1;
+  if (trace->released_chunks >= last)
+     return;
+
+  for (; trace->released_chunks < last; trace->released_chunks++) {
+     instruction_trace_t* chunk = trace->chunks[trace->released_chunks];
+     trace->chunks[trace->released_chunks] = NULL;
+
+     if (trace->spare == NULL)
+        trace->spare = chunk;
+     else
+        free(chunk);
   }
+  trace->next = last < trace->num_chunks ? trace->chunks[last] : NULL;
+}
+
+//frees a trace allocated with malloc, along with all its chunks
+void free_instr_trace(instruction_trace_t* trace) {
 
-  return &trace->table[index];
+  if (trace->total_size > INSTR_TRACE_SIZE) {
+     int chunk;
+     for (chunk = MAX(trace->released_chunks, 1); chunk < trace->num_chunks; chunk++) {
+        free(trace->chunks[chunk]);
+     }
+     free(trace->spare);
+     free(trace->chunks);
+  }
+  free(trace);
 }
 
+/* BINARY TRACE FILES */
+
+#define INSTR_FILE_MAGIC   "TOMTRACE"
+#define INSTR_FILE_VERSION 2
+
+//the first bytes of a trace file; the sizes reject files recorded for another target
+typedef struct instr_file_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t inst_size;   //sizeof(md_inst_t)
+  uint32_t addr_size;   //sizeof(md_addr_t)
+}instr_file_header_t;
+
+//one instruction; its index is its position in the file and its cycles are not kept
+typedef struct instr_file_record
+{
+  unsigned char inst[8]; //md_inst_t
+  uint64_t pc;
+  uint64_t mem_addr;
+  uint16_t op;
+  int8_t r_in[3];
+  int8_t r_out[2];
+}instr_file_record_t;
+
+typedef char instr_file_inst_fits[sizeof(md_inst_t) <= 8 ? 1 : -1];
+
+struct instr_file
+{
+  const unsigned char* map;
+  size_t length;
+  const instr_file_record_t* records;
+  int size;
+};
+
+char* instr_record_path = NULL;
+
+//the file instructions are being recorded to
+static FILE* instr_record_file = NULL;
+
+static void record_instr(instruction_t* instr) {
+
+  if (instr_record_file == NULL) {
+     instr_record_file = fopen(instr_record_path, "wb");
+     if (instr_record_file == NULL)
+        fatal("cannot open trace file `%s' for writing", instr_record_path);
+     setvbuf(instr_record_file, NULL, _IOFBF, 1 << 20);
+
+     instr_file_header_t header;
+     memset(&header, 0, sizeof(header));
+     memcpy(header.magic, INSTR_FILE_MAGIC, sizeof(header.magic));
+     header.version = INSTR_FILE_VERSION;
+     header.record_size = sizeof(instr_file_record_t);
+     header.inst_size = sizeof(md_inst_t);
+     header.addr_size = sizeof(md_addr_t);
+     fwrite(&header, sizeof(header), 1, instr_record_file);
+  }
+
+  instr_file_record_t record;
+  memset(&record, 0, sizeof(record));
+  memcpy(record.inst, &instr->inst, sizeof(md_inst_t));
+  record.pc = instr->pc;
+  record.mem_addr = instr->mem_addr;
+  record.op = instr->op;
+  record.r_in[0] = instr->r_in[0];
+  record.r_in[1] = instr->r_in[1];
+  record.r_in[2] = instr->r_in[2];
+  record.r_out[0] = instr->r_out[0];
+  record.r_out[1] = instr->r_out[1];
+
+  if (fwrite(&record, sizeof(record), 1, instr_record_file) != 1)
+     fatal("cannot write to trace file `%s'", instr_record_path);
+}
+
+//finishes the file being recorded to (put_instr stops recording)
+void close_instr_record(void) {
+
+  if (instr_record_file != NULL && fclose(instr_record_file) != 0)
+     fatal("cannot write to trace file `%s'", instr_record_path);
+
+  instr_record_file = NULL;
+  instr_record_path = NULL;
+}
+
+//maps a trace file; fatal if it is not one, or was recorded for another target
+instr_file_t* open_instr_file(const char* path) {
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+     fatal("cannot open trace file `%s'", path);
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(instr_file_header_t))
+     fatal("`%s' is not a trace file", path);
+
+  const unsigned char* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+     fatal("cannot map trace file `%s'", path);
+  madvise((void*)map, st.st_size, MADV_SEQUENTIAL);
+
+  const instr_file_header_t* header = (const instr_file_header_t*)map;
+  if (memcmp(header->magic, INSTR_FILE_MAGIC, sizeof(header->magic)) != 0)
+     fatal("`%s' is not a trace file", path);
+  if (header->version != INSTR_FILE_VERSION
+      || header->record_size != sizeof(instr_file_record_t)
+      || header->inst_size != sizeof(md_inst_t)
+      || header->addr_size != sizeof(md_addr_t))
+     fatal("trace file `%s' was recorded by an incompatible simulator", path);
+
+  size_t records = (st.st_size - sizeof(instr_file_header_t)) / sizeof(instr_file_record_t);
+  if (records * sizeof(instr_file_record_t) != st.st_size - sizeof(instr_file_header_t))
+     warn("trace file `%s' is truncated; replaying its %lu complete instructions",
+          path, (unsigned long)records);
+  if (records > INT_MAX)
+     fatal("trace file `%s' holds too many instructions", path);
+
+  instr_file_t* file = malloc(sizeof(instr_file_t));
+  assert(file != NULL);
+  file->map = map;
+  file->length = st.st_size;
+  file->records = (const instr_file_record_t*)(map + sizeof(instr_file_header_t));
+  file->size = records;
+  return file;
+}
+
+//number of instructions in a trace file (the dummy at index 0 included)
+int instr_file_size(instr_file_t* file) {
+  return file->size;
+}
+
+//decodes the instruction at the index of a trace file
+void read_instr_file(instr_file_t* file, int index, instruction_t* instr) {
+
+  assert(index >= 0 && index < file->size);
+  const instr_file_record_t* record = &file->records[index];
+
+  memset(instr, 0, sizeof(instruction_t));
+  instr->index = index;
+  memcpy(&instr->inst, record->inst, sizeof(md_inst_t));
+  instr->pc = record->pc;
+  instr->mem_addr = record->mem_addr;
+  instr->op = record->op;
+  instr->r_in[0] = record->r_in[0];
+  instr->r_in[1] = record->r_in[1];
+  instr->r_in[2] = record->r_in[2];
+  instr->r_out[0] = record->r_out[0];
+  instr->r_out[1] = record->r_out[1];
+}
+
+//unmaps a trace file
+void close_instr_file(instr_file_t* file) {
+  munmap((void*)file->map, file->length);
+  free(file);
+}
@@ -2,6 +2,8 @@
 #ifndef INSTR_H
 #define INSTR_H
 
+#include <stdint.h>
+
 #include "machine.h"
 
 //data structure representing each instruction
@@ -14,35 +16,165 @@ typedef struct my_instruction
   int r_in[3]; //input registers
   enum md_opcode op; //opcode
   md_addr_t pc; //program counter the instruction executes at
+  md_addr_t mem_addr; //effective address of a load or store; the caller of put_instr sets it
 
   //the equivalents of Qj, Qk; these are pointers to the instructions producing the results
-  // for the input registers of this instruction
-  struct my_instruction * Q[3]; 
+  // for the input registers of this instruction. The simulator tracks producers in its own
+  // reservation stations and leaves these alone
+  struct my_instruction * Q[3];
 
   //Specify the cycle an instruction **entered** this stage
   int tom_dispatch_cycle;  //dispatch
   int tom_issue_cycle;     //issue
   int tom_execute_cycle;   //execute
   int tom_cdb_cycle;       //writeback via Common Data Bus (CDB)
+  int tom_commit_cycle;    //commit from the reorder buffer (0 without one)
 
 }instruction_t;
 
-#define INSTR_TRACE_SIZE 16384
+//what the machine does with an instruction, decoded once when it is put into the trace
+enum instr_class
+{
+  INSTR_CLASS_SKIP,    //trap or empty slot; never enters the machine
+  INSTR_CLASS_INT,     //uses an INT functional unit (integer computation, load or store)
+  INSTR_CLASS_FP,      //uses an FP functional unit
+  INSTR_CLASS_BRANCH,  //conditional or unconditional control transfer
+  INSTR_CLASS_OTHER    //anything else
+};
+
+//properties of an instruction beyond its class
+#define INSTR_LOAD    0x01
+#define INSTR_STORE   0x02
+#define INSTR_CDB     0x04  //writes its result on the Common Data Bus
+#define INSTR_TAKEN   0x08  //a control transfer that was taken (set once the next instruction is put)
+#define INSTR_COND    0x10  //a conditional branch
+
+//the fields of an instruction the scheduler reads, kept apart from the rest of instruction_t
+//so that scanning the trace does not drag the cold fields (inst, pc, cycles) through the cache.
+//The scheduler reads instruction_t itself only once per instruction at most: a branch's pc as
+//fetch predicts it, and a load or store's address as it is dispatched (its reservation station
+//entry keeps a copy for the load/store queue and the caches)
+typedef struct instr_hot
+{
+  uint8_t cls;      //enum instr_class
+  uint8_t flags;    //INSTR_* properties
+  uint16_t op;      //opcode, which picks the functional unit and the latency
+  int8_t r_in[3];   //input registers
+  int8_t r_out[2];  //output registers
+  uint8_t next;     //distance to the next instruction that is not skipped, 0 if not known (yet)
+}instr_hot_t;
+
+//instructions per chunk of the trace (a power of two, so indexing is a shift and a mask)
+#define INSTR_TRACE_SHIFT 14
+#define INSTR_TRACE_SIZE (1 << INSTR_TRACE_SHIFT)
 
+//the trace is a list of fixed-size chunks that never move, so instruction pointers stay valid.
+//The first chunk also keeps a directory of every chunk, which gives O(1) append and O(1)
+//access to any index; next still links the chunks in order, for code that walks them.
+//A new trace only needs size zeroed and next set to NULL, as before the directory.
 typedef struct my_instruction_list
 {
   instruction_t table[INSTR_TRACE_SIZE];
-  int size;
-  struct my_instruction_list* next;
+  instr_hot_t hot_table[INSTR_TRACE_SIZE];  //the scheduling fields of table
+  int size;                                 //number of instructions in this chunk
+  struct my_instruction_list* next;         //the chunk after this one, NULL in the last
+
+  //kept in the first chunk only
+  int total_size;                           //number of instructions in the trace
+  struct my_instruction_list** chunks;      //every chunk, this one included (once there are more)
+  int num_chunks;                           //chunks in use
+  int max_chunks;                           //room in the chunk directory
+  int released_chunks;                      //leading chunks dropped by release_instr
+  int last_valid;                           //index of the newest instruction that is not skipped
+  struct my_instruction_list* spare;        //a released chunk kept for the next one put_instr needs
 }instruction_trace_t;
 
+/* THE TOMASULO TABLE */
+
+//how the table is written
+enum instr_table_format
+{
+  INSTR_TABLE_TEXT,     //a row of disassembly and stage cycles per instruction
+  INSTR_TABLE_BINARY,   //a header and a fixed-size record per instruction (see instr.c)
+  INSTR_TABLE_NONE      //not at all
+};
+extern int instr_table_format;
+
+//file the table goes to, stdout if NULL
+extern char* instr_table_path;
+
+//only the instructions with indices from first to last are printed, one in every sample
+extern int instr_table_first;
+extern int instr_table_last;
+extern int instr_table_sample;
+
+//if set, the disassembly of each pc is only worked out once
+extern int instr_table_disasm_cache;
+
+//if set, the rows of the Tomasulo table end with the commit cycle
+extern int instr_print_commit;
+
+//starts the table: opens its file and writes the header (the first row does it otherwise)
+extern void open_instr_table(void);
+
+//prints a single instruction as a row of the Tomasulo table, unless the filter leaves it out
+extern void print_tom_instr(instruction_t* instr);
+
+//writes out the rows printed so far and ends the table
+extern void close_instr_table(void);
+
 //prints all the instructions inside the given trace
 extern void print_all_instr(instruction_trace_t* table, int sim_num_insn);
 
-//inserts the instruction into the trace
+//inserts the instruction into the trace. The caller fills in index, inst, op, pc, r_in, r_out
+//and, for loads and stores, mem_addr: the load/store queue and the data caches take the
+//effective address from it, so a load or store left at 0 aliases every other one. In
+//sim-safe's sim_main, the READ_ and WRITE_ macros leave the address in addr, so after the
+//instruction executes:
+//    if (MD_OP_FLAGS(op) & F_MEM) instr.mem_addr = addr;
+//put_instr warns (once) when a load or store arrives without it
 extern void put_instr(instruction_trace_t* trace, instruction_t* instr);
 
 //gets the instruction at the index, from the trace
 extern instruction_t* get_instr(instruction_trace_t* trace, int index);
 
+//gets the scheduling fields of the instruction at the index, from the trace
+static inline const instr_hot_t* get_instr_hot(const instruction_trace_t* trace, int index) {
+  if (index < INSTR_TRACE_SIZE)
+     return &trace->hot_table[index];
+  return &trace->chunks[index >> INSTR_TRACE_SHIFT]->hot_table[index & (INSTR_TRACE_SIZE - 1)];
+}
+
+//drops every instruction before the index from the trace; they can no longer be read
+extern void release_instr(instruction_trace_t* trace, int index);
+
+//frees a trace allocated with malloc, along with all its chunks
+extern void free_instr_trace(instruction_trace_t* trace);
+
+/* BINARY TRACE FILES */
+
+//a trace file is a header followed by one compact record per instruction, starting with the
+//dummy at index 0, so that timing runs can replay a trace without the functional simulator
+
+//if set, every instruction put into a trace is also recorded to this file
+extern char* instr_record_path;
+
+//finishes the file being recorded to (put_instr stops recording)
+extern void close_instr_record(void);
+
+//a trace file mapped for reading
+typedef struct instr_file instr_file_t;
+
+//maps a trace file; fatal if it is not one, or was recorded for another target
+extern instr_file_t* open_instr_file(const char* path);
+
+//number of instructions in a trace file (the dummy at index 0 included)
+extern int instr_file_size(instr_file_t* file);
+
+//decodes the instruction at the index of a trace file
+extern void read_instr_file(instr_file_t* file, int index, instruction_t* instr);
+
+//unmaps a trace file
+extern void close_instr_file(instr_file_t* file);
+
 #endif
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "misc.h"
+
+#include "tom_bpred.h"
+
+//tagged tables of the TAGE predictor, and the global history each one hashes in
+#define TAGE_TABLES   4
+#define TAGE_TAG_BITS 9
+static const int tage_history[TAGE_TABLES] = { 4, 9, 20, 44 };
+
+//updates between two halvings of the TAGE usefulness counters
+#define TAGE_RESET_PERIOD (1 << 18)
+
+static const char* bpred_names[NUM_BPRED_KINDS] = { "perfect", "bimodal", "gshare", "tage" };
+
+//an entry of a tagged table
+typedef struct tage_entry
+{
+  int8_t ctr;     //3-bit signed counter, taken if >= 0
+  uint8_t u;      //2-bit usefulness
+  uint16_t tag;
+}tage_entry_t;
+
+struct tom_bpred
+{
+  int kind;
+  int bits;
+  uint8_t* counters;            //2-bit counters: bimodal, gshare, or the TAGE base
+  uint64_t history;             //global history of conditional branch directions, newest in bit 0
+  tage_entry_t* tagged[TAGE_TABLES];
+  int tagged_bits;              //log2 of the entries in each tagged table
+  int updates;
+};
+
+//the option name of a predictor kind
+const char* tom_bpred_name(int kind) {
+  return kind >= 0 && kind < NUM_BPRED_KINDS ? bpred_names[kind] : "?";
+}
+
+//the predictor kind with the option name, -1 if there is none
+int tom_bpred_lookup(const char* name) {
+  int kind;
+  for (kind = 0; kind < NUM_BPRED_KINDS; kind++) {
+     if (!strcmp(name, bpred_names[kind]))
+        return kind;
+  }
+  return -1;
+}
+
+//creates a predictor with 2^bits entries per table
+tom_bpred_t* tom_bpred_create(int kind, int bits) {
+
+  tom_bpred_t* bp = calloc(1, sizeof(tom_bpred_t));
+  if (!bp)
+     fatal("out of virtual memory");
+
+  bp->kind = kind;
+  bp->bits = bits;
+  if (kind == BPRED_PERFECT)
+     return bp;
+
+  //counters start weakly taken
+  bp->counters = malloc((size_t)1 << bits);
+  if (!bp->counters)
+     fatal("out of virtual memory");
+  memset(bp->counters, 2, (size_t)1 << bits);
+
+  if (kind == BPRED_TAGE) {
+     int t;
+     bp->tagged_bits = MAX(bits - 2, 4);
+     for (t = 0; t < TAGE_TABLES; t++) {
+        bp->tagged[t] = calloc((size_t)1 << bp->tagged_bits, sizeof(tage_entry_t));
+        if (!bp->tagged[t])
+           fatal("out of virtual memory");
+     }
+  }
+  return bp;
+}
+
+//the low length bits of the history, folded into n bits by xor
+static uint32_t fold_history(uint64_t history, int length, int n) {
+  uint64_t h = length >= 64 ? history : history & (((uint64_t)1 << length) - 1);
+  uint32_t folded = 0;
+  while (h) {
+     folded ^= h & (((uint64_t)1 << n) - 1);
+     h >>= n;
+  }
+  return folded;
+}
+
+static void update_counter(uint8_t* counter, bool taken) {
+  if (taken && *counter < 3)
+     (*counter)++;
+  else if (!taken && *counter > 0)
+     (*counter)--;
+}
+
+//TAGE: the longest matching tagged table provides the prediction, the base table if none matches
+static bool tage_update(tom_bpred_t* bp, uint32_t pc, bool taken) {
+
+  uint32_t mask = (1u << bp->tagged_bits) - 1;
+  uint32_t index[TAGE_TABLES];
+  uint16_t tag[TAGE_TABLES];
+  int provider = -1;
+  int alt = -1;
+  int t;
+
+  for (t = 0; t < TAGE_TABLES; t++) {
+     index[t] = (pc ^ (pc >> bp->tagged_bits)
+                 ^ fold_history(bp->history, tage_history[t], bp->tagged_bits)) & mask;
+     tag[t] = (pc ^ fold_history(bp->history, tage_history[t], TAGE_TAG_BITS)
+               ^ (fold_history(bp->history, tage_history[t], TAGE_TAG_BITS - 1) << 1))
+              & ((1u << TAGE_TAG_BITS) - 1);
+  }
+  for (t = TAGE_TABLES - 1; t >= 0; t--) {
+     if (bp->tagged[t][index[t]].tag == tag[t]) {
+        if (provider == -1)
+           provider = t;
+        else if (alt == -1)
+           alt = t;
+     }
+  }
+
+  uint8_t* base = &bp->counters[pc & (((uint32_t)1 << bp->bits) - 1)];
+  bool alt_pred = alt != -1 ? bp->tagged[alt][index[alt]].ctr >= 0 : *base >= 2;
+  bool pred = provider != -1 ? bp->tagged[provider][index[provider]].ctr >= 0 : alt_pred;
+
+  if (provider != -1) {
+     tage_entry_t* entry = &bp->tagged[provider][index[provider]];
+     if (taken && entry->ctr < 3)
+        entry->ctr++;
+     else if (!taken && entry->ctr > -4)
+        entry->ctr--;
+     if (pred != alt_pred) {
+        if (pred == taken && entry->u < 3)
+           entry->u++;
+        else if (pred != taken && entry->u > 0)
+           entry->u--;
+     }
+  }
+  else
+     update_counter(base, taken);
+
+  //a misprediction claims an entry in a table with a longer history
+  if (pred != taken && provider < TAGE_TABLES - 1) {
+     bool allocated = false;
+     for (t = provider + 1; t < TAGE_TABLES; t++) {
+        tage_entry_t* entry = &bp->tagged[t][index[t]];
+        if (entry->u == 0) {
+           entry->tag = tag[t];
+           entry->ctr = taken ? 0 : -1;
+           allocated = true;
+           break;
+        }
+     }
+     if (!allocated) {
+        for (t = provider + 1; t < TAGE_TABLES; t++)
+           bp->tagged[t][index[t]].u--;
+     }
+  }
+
+  if (++bp->updates == TAGE_RESET_PERIOD) {
+     uint32_t i;
+     bp->updates = 0;
+     for (t = 0; t < TAGE_TABLES; t++) {
+        for (i = 0; i <= mask; i++)
+           bp->tagged[t][i].u >>= 1;
+     }
+  }
+  return pred == taken;
+}
+
+//predicts the direction of a conditional branch, then trains on the actual one;
+//returns true if the prediction was right
+bool tom_bpred_update(tom_bpred_t* bp, md_addr_t pc, bool taken) {
+
+  uint32_t word = (uint32_t)(pc / sizeof(md_inst_t));
+  uint32_t mask = ((uint32_t)1 << bp->bits) - 1;
+  bool correct;
+
+  switch (bp->kind) {
+  case BPRED_BIMODAL: {
+     uint8_t* counter = &bp->counters[word & mask];
+     correct = (*counter >= 2) == taken;
+     update_counter(counter, taken);
+     break;
+  }
+  case BPRED_GSHARE: {
+     uint8_t* counter = &bp->counters[(word ^ (uint32_t)bp->history) & mask];
+     correct = (*counter >= 2) == taken;
+     update_counter(counter, taken);
+     break;
+  }
+  case BPRED_TAGE:
+     correct = tage_update(bp, word, taken);
+     break;
+  default:
+     return true;
+  }
+
+  bp->history = (bp->history << 1) | taken;
+  return correct;
+}
+
+//the buffers that hold a predictor's state, for copying and checkpoints; returns how many
+static int state_buffers(const tom_bpred_t* bp, void** buffers, size_t* sizes) {
+  int n = 0;
+  int t;
+
+  buffers[n] = (void*)&bp->history;
+  sizes[n++] = sizeof(bp->history);
+  buffers[n] = (void*)&bp->updates;
+  sizes[n++] = sizeof(bp->updates);
+  if (bp->counters) {
+     buffers[n] = bp->counters;
+     sizes[n++] = (size_t)1 << bp->bits;
+  }
+  for (t = 0; t < TAGE_TABLES; t++) {
+     if (bp->tagged[t]) {
+        buffers[n] = bp->tagged[t];
+        sizes[n++] = ((size_t)1 << bp->tagged_bits) * sizeof(tage_entry_t);
+     }
+  }
+  return n;
+}
+#define BPRED_MAX_BUFFERS (3 + TAGE_TABLES)
+
+//makes a predictor of the same kind and size hold the same state as another
+void tom_bpred_copy(tom_bpred_t* dst, const tom_bpred_t* src) {
+  void* from[BPRED_MAX_BUFFERS];
+  void* to[BPRED_MAX_BUFFERS];
+  size_t sizes[BPRED_MAX_BUFFERS];
+  int n = state_buffers(src, from, sizes);
+  int i;
+
+  state_buffers(dst, to, sizes);
+  for (i = 0; i < n; i++)
+     memcpy(to[i], from[i], sizes[i]);
+}
+
+//writes the predictor's state to a file
+void tom_bpred_save(const tom_bpred_t* bp, FILE* f) {
+  void* buffers[BPRED_MAX_BUFFERS];
+  size_t sizes[BPRED_MAX_BUFFERS];
+  int n = state_buffers(bp, buffers, sizes);
+  int i;
+  for (i = 0; i < n; i++)
+     fwrite(buffers[i], sizes[i], 1, f);
+}
+
+//reads a state tom_bpred_save wrote into a predictor of the same kind and size; returns
+//false if the file ends first
+bool tom_bpred_restore(tom_bpred_t* bp, FILE* f) {
+  void* buffers[BPRED_MAX_BUFFERS];
+  size_t sizes[BPRED_MAX_BUFFERS];
+  int n = state_buffers(bp, buffers, sizes);
+  int i;
+  for (i = 0; i < n; i++) {
+     if (fread(buffers[i], sizes[i], 1, f) != 1)
+        return false;
+  }
+  return true;
+}
+
+void tom_bpred_free(tom_bpred_t* bp) {
+  int t;
+  if (!bp)
+     return;
+  for (t = 0; t < TAGE_TABLES; t++)
+     free(bp->tagged[t]);
+  free(bp->counters);
+  free(bp);
+}
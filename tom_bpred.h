@@ -0,0 +1,48 @@
+#ifndef TOM_BPRED_H
+#define TOM_BPRED_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "host.h"
+#include "machine.h"
+
+//conditional branch direction predictors of the Tomasulo machine
+enum tom_bpred_kind
+{
+  BPRED_PERFECT,  //every branch predicted correctly (branches cost nothing)
+  BPRED_BIMODAL,  //2-bit counters indexed by the branch address
+  BPRED_GSHARE,   //2-bit counters indexed by the address xor the global history
+  BPRED_TAGE,     //a bimodal base with four tagged tables over geometric history lengths
+  NUM_BPRED_KINDS
+};
+
+//a predictor instance; each simulated machine trains its own
+typedef struct tom_bpred tom_bpred_t;
+
+//the option name of a predictor kind
+extern const char* tom_bpred_name(int kind);
+
+//the predictor kind with the option name, -1 if there is none
+extern int tom_bpred_lookup(const char* name);
+
+//creates a predictor with 2^bits entries per table
+extern tom_bpred_t* tom_bpred_create(int kind, int bits);
+
+//predicts the direction of a conditional branch, then trains on the actual one;
+//returns true if the prediction was right
+extern bool tom_bpred_update(tom_bpred_t* bp, md_addr_t pc, bool taken);
+
+//makes a predictor of the same kind and size hold the same state as another
+extern void tom_bpred_copy(tom_bpred_t* dst, const tom_bpred_t* src);
+
+//writes the predictor's state to a file
+extern void tom_bpred_save(const tom_bpred_t* bp, FILE* f);
+
+//reads a state tom_bpred_save wrote into a predictor of the same kind and size; returns
+//false if the file ends first
+extern bool tom_bpred_restore(tom_bpred_t* bp, FILE* f);
+
+extern void tom_bpred_free(tom_bpred_t* bp);
+
+#endif
@@ -0,0 +1,245 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "misc.h"
+
+#include "tom_cache.h"
+
+//a set-associative level with LRU replacement
+typedef struct cache_level
+{
+  int sets;
+  int assoc;
+  md_addr_t* tags;      //line number + 1 of each way, 0 if the way is empty
+  uint64_t* last_use;   //LRU stamp of each way
+  uint64_t clock;
+}cache_level_t;
+
+struct tom_cache
+{
+  tom_cache_config_t cfg;
+  int line_bits;
+  cache_level_t l1d;
+  cache_level_t l2;
+  md_addr_t* mshr_line;  //line each MSHR fetches
+  int* mshr_fill;        //cycle it arrives; the MSHR is free from then on
+};
+
+//number of sets of a cache level; 0 unless it divides into a power of two
+int tom_cache_sets(int kb, int assoc, int line_size) {
+  if (kb < 1 || assoc < 1 || line_size < 1 || (line_size & (line_size - 1)))
+     return 0;
+  long bytes = (long)kb * 1024;
+  if (bytes % ((long)assoc * line_size))
+     return 0;
+  long sets = bytes / ((long)assoc * line_size);
+  return (sets & (sets - 1)) || sets > INT_MAX ? 0 : (int)sets;
+}
+
+static void level_init(cache_level_t* level, int kb, int assoc, int line_size) {
+  level->sets = tom_cache_sets(kb, assoc, line_size);
+  level->assoc = assoc;
+  level->tags = calloc((size_t)level->sets * assoc, sizeof(md_addr_t));
+  level->last_use = calloc((size_t)level->sets * assoc, sizeof(uint64_t));
+  if (!level->tags || !level->last_use)
+     fatal("out of virtual memory");
+}
+
+//looks a line up and makes it the most recently used; a miss replaces the LRU way with it.
+//Returns true on a hit
+static bool level_access(cache_level_t* level, md_addr_t line) {
+  md_addr_t* tags = &level->tags[(size_t)(line & (level->sets - 1)) * level->assoc];
+  uint64_t* last_use = &level->last_use[(size_t)(line & (level->sets - 1)) * level->assoc];
+  int victim = 0;
+  int way;
+
+  level->clock++;
+  for (way = 0; way < level->assoc; way++) {
+     if (tags[way] == line + 1) {
+        last_use[way] = level->clock;
+        return true;
+     }
+     if (last_use[way] < last_use[victim])
+        victim = way;
+  }
+  tags[victim] = line + 1;
+  last_use[victim] = level->clock;
+  return false;
+}
+
+//creates an empty hierarchy; the configuration must have a valid L1D
+tom_cache_t* tom_cache_create(const tom_cache_config_t* cfg) {
+
+  tom_cache_t* c = calloc(1, sizeof(tom_cache_t));
+  if (!c)
+     fatal("out of virtual memory");
+
+  c->cfg = *cfg;
+  while ((1 << c->line_bits) < cfg->line_size)
+     c->line_bits++;
+  level_init(&c->l1d, cfg->l1d_kb, cfg->l1d_assoc, cfg->line_size);
+  if (cfg->l2_kb)
+     level_init(&c->l2, cfg->l2_kb, cfg->l2_assoc, cfg->line_size);
+
+  c->mshr_line = calloc(cfg->mshrs, sizeof(md_addr_t));
+  c->mshr_fill = calloc(cfg->mshrs, sizeof(int));
+  if (!c->mshr_line || !c->mshr_fill)
+     fatal("out of virtual memory");
+  return c;
+}
+
+//an L1 miss from the cycle on: the cycle the line arrives from the L2 or memory
+static int miss_ready(tom_cache_t* c, md_addr_t line, int start, tom_cache_stats_t* stats) {
+  int ready = start + c->cfg.l1d_latency;
+
+  if (c->cfg.l2_kb) {
+     stats->l2_accesses++;
+     ready += c->cfg.l2_latency;
+     if (level_access(&c->l2, line)) {
+        stats->l2_hits++;
+        return ready;
+     }
+  }
+  return ready + c->cfg.mem_latency;
+}
+
+//a load accesses the hierarchy in the cycle; returns the cycle its data is ready
+int tom_cache_load(tom_cache_t* c, md_addr_t addr, int cycle, tom_cache_stats_t* stats) {
+
+  md_addr_t line = addr >> c->line_bits;
+  int slot = 0;
+  int i;
+
+  stats->l1d_accesses++;
+
+  //the line is already on its way (its tag is in the L1D from the first miss on)
+  for (i = 0; i < c->cfg.mshrs; i++) {
+     if (c->mshr_fill[i] > cycle && c->mshr_line[i] == line) {
+        stats->mshr_merges++;
+        return MAX(cycle + c->cfg.l1d_latency, c->mshr_fill[i]);
+     }
+  }
+
+  if (level_access(&c->l1d, line)) {
+     stats->l1d_hits++;
+     return cycle + c->cfg.l1d_latency;
+  }
+
+  //a new miss takes the MSHR that frees up first, waiting for it if none is free yet
+  for (i = 1; i < c->cfg.mshrs; i++) {
+     if (c->mshr_fill[i] < c->mshr_fill[slot])
+        slot = i;
+  }
+  int start = cycle;
+  if (c->mshr_fill[slot] > cycle) {
+     stats->mshr_full++;
+     stats->mshr_full_cycles += c->mshr_fill[slot] - cycle;
+     start = c->mshr_fill[slot];
+  }
+
+  c->mshr_line[slot] = line;
+  c->mshr_fill[slot] = miss_ready(c, line, start, stats);
+  return c->mshr_fill[slot];
+}
+
+//a store writes its line into the hierarchy (write-allocate, through a write buffer: it never waits)
+void tom_cache_store(tom_cache_t* c, md_addr_t addr, int cycle, tom_cache_stats_t* stats) {
+
+  md_addr_t line = addr >> c->line_bits;
+
+  stats->l1d_accesses++;
+  if (level_access(&c->l1d, line)) {
+     stats->l1d_hits++;
+     return;
+  }
+  if (c->cfg.l2_kb) {
+     stats->l2_accesses++;
+     if (level_access(&c->l2, line))
+        stats->l2_hits++;
+  }
+}
+
+//brings the line of an address into the hierarchy without timing or counting the access
+void tom_cache_touch(tom_cache_t* c, md_addr_t addr) {
+  md_addr_t line = addr >> c->line_bits;
+  if (!level_access(&c->l1d, line) && c->cfg.l2_kb)
+     level_access(&c->l2, line);
+}
+
+//the buffers that hold a hierarchy's state, for copying and checkpoints; returns how many
+static int state_buffers(const tom_cache_t* c, void** buffers, size_t* sizes) {
+  const cache_level_t* levels[2] = { &c->l1d, &c->l2 };
+  int n = 0;
+  int l;
+
+  for (l = 0; l < 2; l++) {
+     size_t ways = (size_t)levels[l]->sets * levels[l]->assoc;
+     if (!levels[l]->tags)
+        continue;
+     buffers[n] = levels[l]->tags;
+     sizes[n++] = ways * sizeof(md_addr_t);
+     buffers[n] = levels[l]->last_use;
+     sizes[n++] = ways * sizeof(uint64_t);
+     buffers[n] = (void*)&levels[l]->clock;
+     sizes[n++] = sizeof(uint64_t);
+  }
+  buffers[n] = c->mshr_line;
+  sizes[n++] = c->cfg.mshrs * sizeof(md_addr_t);
+  buffers[n] = c->mshr_fill;
+  sizes[n++] = c->cfg.mshrs * sizeof(int);
+  return n;
+}
+#define CACHE_MAX_BUFFERS 8
+
+//makes a hierarchy of the same configuration hold the same lines and MSHRs as another
+void tom_cache_copy(tom_cache_t* dst, const tom_cache_t* src) {
+  void* from[CACHE_MAX_BUFFERS];
+  void* to[CACHE_MAX_BUFFERS];
+  size_t sizes[CACHE_MAX_BUFFERS];
+  int n = state_buffers(src, from, sizes);
+  int i;
+
+  state_buffers(dst, to, sizes);
+  for (i = 0; i < n; i++)
+     memcpy(to[i], from[i], sizes[i]);
+}
+
+//writes the hierarchy's state to a file
+void tom_cache_save(const tom_cache_t* c, FILE* f) {
+  void* buffers[CACHE_MAX_BUFFERS];
+  size_t sizes[CACHE_MAX_BUFFERS];
+  int n = state_buffers(c, buffers, sizes);
+  int i;
+  for (i = 0; i < n; i++)
+     fwrite(buffers[i], sizes[i], 1, f);
+}
+
+//reads a state tom_cache_save wrote into a hierarchy of the same configuration; returns
+//false if the file ends first
+bool tom_cache_restore(tom_cache_t* c, FILE* f) {
+  void* buffers[CACHE_MAX_BUFFERS];
+  size_t sizes[CACHE_MAX_BUFFERS];
+  int n = state_buffers(c, buffers, sizes);
+  int i;
+  for (i = 0; i < n; i++) {
+     if (fread(buffers[i], sizes[i], 1, f) != 1)
+        return false;
+  }
+  return true;
+}
+
+void tom_cache_free(tom_cache_t* c) {
+  if (!c)
+     return;
+  free(c->l1d.tags);
+  free(c->l1d.last_use);
+  free(c->l2.tags);
+  free(c->l2.last_use);
+  free(c->mshr_line);
+  free(c->mshr_fill);
+  free(c);
+}
@@ -0,0 +1,67 @@
+#ifndef TOM_CACHE_H
+#define TOM_CACHE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "host.h"
+#include "machine.h"
+
+//the data memory hierarchy of the Tomasulo machine: an L1D, an optional L2, and DRAM
+typedef struct tom_cache_config
+{
+  int l1d_kb;        //L1 data cache size, 0 for no cache (loads take their unit's latency)
+  int l1d_assoc;
+  int l1d_latency;   //cycles of an L1 hit
+  int l2_kb;         //L2 size, 0 if L1 misses go straight to memory
+  int l2_assoc;
+  int l2_latency;    //cycles an L2 hit adds to an L1 miss
+  int mem_latency;   //cycles a memory access adds to an L2 miss
+  int line_size;     //bytes per line, at both levels
+  int mshrs;         //L1 misses that can be outstanding at once
+}tom_cache_config_t;
+
+//event counts of the hierarchy
+typedef struct tom_cache_stats
+{
+  counter_t l1d_accesses;     //loads and stores that reached the L1D
+  counter_t l1d_hits;
+  counter_t l2_accesses;
+  counter_t l2_hits;
+  counter_t mshr_merges;      //load misses to a line already being fetched
+  counter_t mshr_full;        //load misses that waited for a free MSHR
+  counter_t mshr_full_cycles; //cycles they waited in total
+}tom_cache_stats_t;
+
+//the caches and MSHRs of one simulated machine
+typedef struct tom_cache tom_cache_t;
+
+//number of sets of a cache level; 0 unless it divides into a power of two
+extern int tom_cache_sets(int kb, int assoc, int line_size);
+
+//creates an empty hierarchy; the configuration must have a valid L1D
+extern tom_cache_t* tom_cache_create(const tom_cache_config_t* cfg);
+
+//a load accesses the hierarchy in the cycle; returns the cycle its data is ready
+extern int tom_cache_load(tom_cache_t* c, md_addr_t addr, int cycle, tom_cache_stats_t* stats);
+
+//a store writes its line into the hierarchy (write-allocate, through a write buffer: it never waits)
+extern void tom_cache_store(tom_cache_t* c, md_addr_t addr, int cycle, tom_cache_stats_t* stats);
+
+//brings the line of an address into the hierarchy without timing or counting the access, as
+//functional warming does for loads and stores alike
+extern void tom_cache_touch(tom_cache_t* c, md_addr_t addr);
+
+//makes a hierarchy of the same configuration hold the same lines and MSHRs as another
+extern void tom_cache_copy(tom_cache_t* dst, const tom_cache_t* src);
+
+//writes the hierarchy's state to a file
+extern void tom_cache_save(const tom_cache_t* c, FILE* f);
+
+//reads a state tom_cache_save wrote into a hierarchy of the same configuration; returns
+//false if the file ends first
+extern bool tom_cache_restore(tom_cache_t* c, FILE* f);
+
+extern void tom_cache_free(tom_cache_t* c);
+
+#endif
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "misc.h"
+
+#include "tom_occupancy.h"
+
+//a binary time series file is this header, the column names (TOM_OCC_NAME_SIZE bytes each,
+//NUL padded), then one record per interval: the uint64_t first cycle of the interval, the
+//uint64_t instructions fetched in it, and the float average occupancy of every column
+#define OCC_FILE_MAGIC   "TOMOCCUP"
+#define OCC_FILE_VERSION 1
+#define TOM_OCC_NAME_SIZE 16
+
+typedef struct occ_file_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t columns;
+  uint32_t interval;    //cycles per record (the last one may be shorter)
+  uint32_t name_size;   //TOM_OCC_NAME_SIZE
+}occ_file_header_t;
+
+struct tom_occupancy
+{
+  int columns;
+  char names[TOM_OCC_MAX_COLUMNS][TOM_OCC_NAME_SIZE];
+  int capacity[TOM_OCC_MAX_COLUMNS];
+  counter_t* histogram[TOM_OCC_MAX_COLUMNS];
+  counter_t sum[TOM_OCC_MAX_COLUMNS];  //entries in use, summed over the cycles
+  counter_t cycles;                    //cycles sampled so far
+  counter_t fetched;                   //instructions fetched so far
+
+  //time series: the file, and the interval being summed up
+  FILE* out;
+  char* path;
+  bool binary;
+  int interval;
+  counter_t row_start;                     //first cycle of the interval
+  counter_t row_fetched;                   //instructions fetched before it
+  counter_t row_sum[TOM_OCC_MAX_COLUMNS];
+};
+
+//creates a sampler over structures of 0..capacity[i] entries; if path is not NULL, a row is
+//written there every interval cycles, as CSV or in the binary form described above
+tom_occupancy_t* tom_occupancy_create(int columns, const char* const* names, const int* capacity,
+                                      const char* path, bool binary, int interval) {
+
+  tom_occupancy_t* occ = calloc(1, sizeof(tom_occupancy_t));
+  int c;
+  if (!occ)
+     fatal("out of virtual memory");
+  if (columns > TOM_OCC_MAX_COLUMNS)
+     panic("occupancy sampler over %d structures (at most %d)", columns, TOM_OCC_MAX_COLUMNS);
+
+  occ->columns = columns;
+  for (c = 0; c < columns; c++) {
+     strncpy(occ->names[c], names[c], TOM_OCC_NAME_SIZE - 1);
+     occ->capacity[c] = capacity[c];
+     occ->histogram[c] = calloc(capacity[c] + 1, sizeof(counter_t));
+     if (!occ->histogram[c])
+        fatal("out of virtual memory");
+  }
+
+  if (!path)
+     return occ;
+  occ->out = fopen(path, binary ? "wb" : "w");
+  if (!occ->out)
+     fatal("cannot open occupancy file `%s' for writing", path);
+  setvbuf(occ->out, NULL, _IOFBF, 1 << 20);
+  occ->path = mystrdup((char*)path);
+  occ->binary = binary;
+  occ->interval = interval;
+
+  if (binary) {
+     occ_file_header_t header;
+     memset(&header, 0, sizeof(header));
+     memcpy(header.magic, OCC_FILE_MAGIC, sizeof(header.magic));
+     header.version = OCC_FILE_VERSION;
+     header.columns = columns;
+     header.interval = interval;
+     header.name_size = TOM_OCC_NAME_SIZE;
+     fwrite(&header, sizeof(header), 1, occ->out);
+     fwrite(occ->names, TOM_OCC_NAME_SIZE, columns, occ->out);
+  }
+  else {
+     fprintf(occ->out, "cycle,fetched");
+     for (c = 0; c < columns; c++)
+        fprintf(occ->out, ",%s", occ->names[c]);
+     fprintf(occ->out, "\n");
+  }
+  return occ;
+}
+
+//writes the interval that ends with the cycles sampled so far, and starts the next one
+static void write_row(tom_occupancy_t* occ) {
+
+  counter_t length = occ->cycles - occ->row_start;
+  int c;
+
+  if (occ->binary) {
+     uint64_t head[2] = { occ->row_start, occ->fetched - occ->row_fetched };
+     float average[TOM_OCC_MAX_COLUMNS];
+     for (c = 0; c < occ->columns; c++)
+        average[c] = (float)occ->row_sum[c] / length;
+     fwrite(head, sizeof(head), 1, occ->out);
+     fwrite(average, sizeof(float), occ->columns, occ->out);
+  }
+  else {
+     fprintf(occ->out, "%lld,%lld", (long long)occ->row_start,
+             (long long)(occ->fetched - occ->row_fetched));
+     for (c = 0; c < occ->columns; c++)
+        fprintf(occ->out, ",%.3f", (double)occ->row_sum[c] / length);
+     fprintf(occ->out, "\n");
+  }
+  if (ferror(occ->out))
+     fatal("cannot write to occupancy file `%s'", occ->path);
+
+  occ->row_start = occ->cycles;
+  occ->row_fetched = occ->fetched;
+  memset(occ->row_sum, 0, sizeof(occ->row_sum));
+}
+
+//the structures held the values for the next cycles; fetched is the number of instructions
+//fetched so far
+void tom_occupancy_add(tom_occupancy_t* occ, const int* values, int cycles, counter_t fetched) {
+
+  int c;
+  for (c = 0; c < occ->columns; c++) {
+     occ->histogram[c][values[c]] += cycles;
+     occ->sum[c] += (counter_t)values[c] * cycles;
+  }
+  occ->fetched = fetched;
+
+  if (!occ->out) {
+     occ->cycles += cycles;
+     return;
+  }
+
+  //the cycles may run over the end of the interval, or over several
+  while (cycles > 0) {
+     int n = (int)MIN((counter_t)cycles, occ->row_start + occ->interval - occ->cycles);
+     for (c = 0; c < occ->columns; c++)
+        occ->row_sum[c] += (counter_t)values[c] * n;
+     occ->cycles += n;
+     cycles -= n;
+     if (occ->cycles == occ->row_start + occ->interval)
+        write_row(occ);
+  }
+}
+
+//cycles the structure spent with each number of entries in use (capacity + 1 counts)
+const counter_t* tom_occupancy_histogram(const tom_occupancy_t* occ, int column) {
+  return occ->histogram[column];
+}
+
+//average number of entries of the structure in use
+double tom_occupancy_mean(const tom_occupancy_t* occ, int column) {
+  return occ->cycles ? (double)occ->sum[column] / occ->cycles : 0.0;
+}
+
+//writes the last, partial interval and closes the file
+void tom_occupancy_finish(tom_occupancy_t* occ) {
+
+  if (!occ->out)
+     return;
+  if (occ->cycles > occ->row_start)
+     write_row(occ);
+  if (fclose(occ->out) != 0)
+     fatal("cannot write to occupancy file `%s'", occ->path);
+  occ->out = NULL;
+}
+
+void tom_occupancy_free(tom_occupancy_t* occ) {
+  int c;
+  if (!occ)
+     return;
+  if (occ->out)
+     fclose(occ->out);
+  for (c = 0; c < occ->columns; c++)
+     free(occ->histogram[c]);
+  free(occ->path);
+  free(occ);
+}
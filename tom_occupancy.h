@@ -0,0 +1,36 @@
+#ifndef TOM_OCCUPANCY_H
+#define TOM_OCCUPANCY_H
+
+#include <stdbool.h>
+
+#include "host.h"
+
+//most structures a sampler can follow
+#define TOM_OCC_MAX_COLUMNS 16
+
+//occupancy sampling of the Tomasulo machine: for every structure, a histogram of the cycles
+//spent with each number of entries in use, and optionally a time series of the average
+//occupancy over every interval of cycles, written to a file
+typedef struct tom_occupancy tom_occupancy_t;
+
+//creates a sampler over structures of 0..capacity[i] entries; if path is not NULL, a row is
+//written there every interval cycles, as CSV or in the binary form described in tom_occupancy.c
+extern tom_occupancy_t* tom_occupancy_create(int columns, const char* const* names, const int* capacity,
+                                             const char* path, bool binary, int interval);
+
+//the structures held the values for the next cycles; fetched is the number of instructions
+//fetched so far
+extern void tom_occupancy_add(tom_occupancy_t* occ, const int* values, int cycles, counter_t fetched);
+
+//cycles the structure spent with each number of entries in use (capacity + 1 counts)
+extern const counter_t* tom_occupancy_histogram(const tom_occupancy_t* occ, int column);
+
+//average number of entries of the structure in use
+extern double tom_occupancy_mean(const tom_occupancy_t* occ, int column);
+
+//writes the last, partial interval and closes the file
+extern void tom_occupancy_finish(tom_occupancy_t* occ);
+
+extern void tom_occupancy_free(tom_occupancy_t* occ);
+
+#endif
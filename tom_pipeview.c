@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "misc.h"
+#include "machine.h"
+
+#include "tom_pipeview.h"
+
+static const char* pipeview_names[NUM_PIPEVIEW_FORMATS] = { "konata", "chrome" };
+
+//the stages an instruction goes through, as the viewers label them
+enum pipeview_stage { STAGE_DISPATCH, STAGE_ISSUE, STAGE_EXECUTE, STAGE_CDB, STAGE_COMMIT, NUM_STAGES };
+static const char* stage_names[NUM_STAGES] = { "Ds", "Is", "Ex", "Wb", "Cm" };
+
+//a Konata command due in a later cycle: a stage starting, or the instruction retiring (stage -1)
+typedef struct pipeview_event
+{
+  int cycle;
+  int id;
+  int stage;
+}pipeview_event_t;
+
+struct tom_pipeview
+{
+  FILE* out;
+  char* path;
+  int format;
+  int first_index, last_index;
+  int first_cycle, last_cycle;
+  int written;                  //instructions written so far (Konata ids count from 0)
+
+  //Konata commands go out in cycle order: the cycle the log is at (-1 before the first
+  //command), and the commands of instructions already written that lie ahead of it (a
+  //min-heap by cycle). Dispatch is in order, so nothing can come before the newest dispatch
+  int cycle;
+  pipeview_event_t* pending;
+  int num_pending;
+  int max_pending;
+};
+
+//the format with the option name, -1 if there is none
+int tom_pipeview_lookup(const char* name) {
+  int format;
+  for (format = 0; format < NUM_PIPEVIEW_FORMATS; format++) {
+     if (!strcmp(name, pipeview_names[format]))
+        return format;
+  }
+  return -1;
+}
+
+//starts a file that takes the instructions with indices in [first_index, last_index] whose
+//stages overlap the cycles [first_cycle, last_cycle]
+tom_pipeview_t* tom_pipeview_open(const char* path, int format, int first_index, int last_index,
+                                  int first_cycle, int last_cycle) {
+
+  tom_pipeview_t* view = calloc(1, sizeof(tom_pipeview_t));
+  if (!view)
+     fatal("out of virtual memory");
+
+  view->out = fopen(path, "w");
+  if (!view->out)
+     fatal("cannot open pipeline file `%s' for writing", path);
+  setvbuf(view->out, NULL, _IOFBF, 1 << 20);
+  view->path = mystrdup((char*)path);
+  view->format = format;
+  view->first_index = first_index;
+  view->last_index = last_index;
+  view->first_cycle = first_cycle;
+  view->last_cycle = last_cycle;
+  view->cycle = -1;
+
+  if (format == PIPEVIEW_KONATA)
+     fprintf(view->out, "Kanata\t0004\n");
+  else
+     fprintf(view->out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  return view;
+}
+
+/* KONATA */
+
+static void heap_push(tom_pipeview_t* view, int cycle, int id, int stage) {
+  if (view->num_pending == view->max_pending) {
+     view->max_pending = view->max_pending ? view->max_pending * 2 : 256;
+     view->pending = realloc(view->pending, view->max_pending * sizeof(pipeview_event_t));
+     if (!view->pending)
+        fatal("out of virtual memory");
+  }
+
+  int i = view->num_pending++;
+  while (i > 0 && view->pending[(i - 1) / 2].cycle > cycle) {
+     view->pending[i] = view->pending[(i - 1) / 2];
+     i = (i - 1) / 2;
+  }
+  view->pending[i].cycle = cycle;
+  view->pending[i].id = id;
+  view->pending[i].stage = stage;
+}
+
+static pipeview_event_t heap_pop(tom_pipeview_t* view) {
+  pipeview_event_t top = view->pending[0];
+  pipeview_event_t last = view->pending[--view->num_pending];
+  int i = 0;
+
+  while (2 * i + 1 < view->num_pending) {
+     int child = 2 * i + 1;
+     if (child + 1 < view->num_pending && view->pending[child + 1].cycle < view->pending[child].cycle)
+        child++;
+     if (view->pending[child].cycle >= last.cycle)
+        break;
+     view->pending[i] = view->pending[child];
+     i = child;
+  }
+  view->pending[i] = last;
+  return top;
+}
+
+//moves the log on to the cycle
+static void konata_advance(tom_pipeview_t* view, int cycle) {
+  if (view->cycle < 0)
+     fprintf(view->out, "C=\t%d\n", cycle);
+  else if (cycle > view->cycle)
+     fprintf(view->out, "C\t%d\n", cycle - view->cycle);
+  else
+     return;
+  view->cycle = cycle;
+}
+
+//writes the pending commands due before the cycle
+static void konata_flush(tom_pipeview_t* view, int cycle) {
+  while (view->num_pending && view->pending[0].cycle < cycle) {
+     pipeview_event_t event = heap_pop(view);
+     konata_advance(view, event.cycle);
+     if (event.stage >= 0)
+        fprintf(view->out, "S\t%d\t0\t%s\n", event.id, stage_names[event.stage]);
+     else
+        fprintf(view->out, "R\t%d\t%d\t0\n", event.id, event.id);
+  }
+}
+
+//an instruction enters the log at its dispatch; its other stages and its retirement wait
+static void konata_instr(tom_pipeview_t* view, const instruction_t* instr, const int* start, int end) {
+  int id = view->written;
+  int s;
+
+  konata_flush(view, start[STAGE_DISPATCH]);
+  konata_advance(view, start[STAGE_DISPATCH]);
+  fprintf(view->out, "I\t%d\t%d\t0\nL\t%d\t0\t%d: ", id, instr->index, id, instr->index);
+  md_print_insn(instr->inst, instr->pc, view->out);
+  fprintf(view->out, "\nS\t%d\t0\t%s\n", id, stage_names[STAGE_DISPATCH]);
+
+  for (s = STAGE_DISPATCH + 1; s < NUM_STAGES; s++) {
+     if (start[s])
+        heap_push(view, start[s], id, s);
+  }
+  heap_push(view, end, id, -1);
+}
+
+/* CHROME */
+
+//one row per instruction, named after it, with a slice per stage; the disassembly has no
+//characters JSON needs escaped
+static void chrome_instr(tom_pipeview_t* view, const instruction_t* instr, const int* start, int end) {
+  int s;
+
+  fprintf(view->out, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,\"tid\":%d,"
+          "\"args\":{\"name\":\"%d: ", view->written ? ",\n" : "", instr->index, instr->index);
+  md_print_insn(instr->inst, instr->pc, view->out);
+  fprintf(view->out, "\"}}");
+
+  for (s = STAGE_DISPATCH; s < NUM_STAGES; s++) {
+     if (!start[s])
+        continue;
+     int next = s + 1;
+     while (next < NUM_STAGES && !start[next])
+        next++;
+     fprintf(view->out, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":0,\"tid\":%d,\"ts\":%d,\"dur\":%d}",
+             stage_names[s], instr->index, start[s], (next < NUM_STAGES ? start[next] : end) - start[s]);
+  }
+}
+
+//adds an instruction once its stage cycles are final; instructions come in index order
+void tom_pipeview_instr(tom_pipeview_t* view, const instruction_t* instr) {
+
+  //0 for the stages it skips; instructions that never entered the machine have none
+  int start[NUM_STAGES] = { instr->tom_dispatch_cycle, instr->tom_issue_cycle,
+                            instr->tom_execute_cycle, instr->tom_cdb_cycle, instr->tom_commit_cycle };
+  int end = 0;
+  int s;
+
+  if (!start[STAGE_DISPATCH] || instr->index < view->first_index || instr->index > view->last_index)
+     return;
+  //the last stage is shown for a cycle
+  for (s = 0; s < NUM_STAGES; s++) {
+     if (start[s])
+        end = start[s] + 1;
+  }
+  if (start[STAGE_DISPATCH] > view->last_cycle || end <= view->first_cycle)
+     return;
+
+  if (view->format == PIPEVIEW_KONATA)
+     konata_instr(view, instr, start, end);
+  else
+     chrome_instr(view, instr, start, end);
+  view->written++;
+
+  if (ferror(view->out))
+     fatal("cannot write to pipeline file `%s'", view->path);
+}
+
+//true once no later instruction can be in the windows, so the caller can stop early
+bool tom_pipeview_done(const tom_pipeview_t* view, const instruction_t* instr) {
+  return instr->index >= view->last_index || instr->tom_dispatch_cycle > view->last_cycle;
+}
+
+//writes out what is pending and closes the file
+void tom_pipeview_close(tom_pipeview_t* view) {
+
+  if (view->format == PIPEVIEW_KONATA)
+     konata_flush(view, INT_MAX);
+  else
+     fprintf(view->out, "\n]}\n");
+
+  if (fclose(view->out) != 0)
+     fatal("cannot write to pipeline file `%s'", view->path);
+  free(view->path);
+  free(view->pending);
+  free(view);
+}
@@ -0,0 +1,36 @@
+#ifndef TOM_PIPEVIEW_H
+#define TOM_PIPEVIEW_H
+
+#include <stdbool.h>
+
+#include "instr.h"
+
+//pipeline viewer formats
+enum tom_pipeview_format
+{
+  PIPEVIEW_KONATA,   //Kanata log, for the Konata pipeline viewer
+  PIPEVIEW_CHROME,   //trace_event JSON, for chrome://tracing and Perfetto
+  NUM_PIPEVIEW_FORMATS
+};
+
+//exports the stages of every instruction of a run, as a timeline a pipeline viewer can read
+typedef struct tom_pipeview tom_pipeview_t;
+
+//the format with the option name, -1 if there is none
+extern int tom_pipeview_lookup(const char* name);
+
+//starts a file that takes the instructions with indices in [first_index, last_index] whose
+//stages overlap the cycles [first_cycle, last_cycle]
+extern tom_pipeview_t* tom_pipeview_open(const char* path, int format, int first_index, int last_index,
+                                         int first_cycle, int last_cycle);
+
+//adds an instruction once its stage cycles are final; instructions come in index order
+extern void tom_pipeview_instr(tom_pipeview_t* view, const instruction_t* instr);
+
+//true once no later instruction can be in the windows, so the caller can stop early
+extern bool tom_pipeview_done(const tom_pipeview_t* view, const instruction_t* instr);
+
+//writes out what is pending and closes the file
+extern void tom_pipeview_close(tom_pipeview_t* view);
+
+#endif
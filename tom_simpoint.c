@@ -0,0 +1,313 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "misc.h"
+#include "machine.h"
+
+#include "tom_simpoint.h"
+
+//dimensions basic block vectors are projected to, as SimPoint does
+#define BBV_DIMS 15
+
+//most k-means iterations per clustering
+#define KMEANS_ITERATIONS 100
+
+//the smallest clustering whose BIC reaches this fraction of the range of BICs is taken
+#define BIC_THRESHOLD 0.9
+
+#define TWO_PI 6.283185307179586
+
+//xorshift generator, so that the picks neither depend on nor disturb rand()
+static uint32_t next_random(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+//the random projection of a basic block onto a dimension, in [-1, 1), fixed by the block's address
+static double projection(md_addr_t pc, int dim) {
+  uint64_t h = (uint64_t)pc * 0x9E3779B97F4A7C15ull + (uint64_t)(dim + 1) * 0xBF58476D1CE4E5B9ull;
+  h ^= h >> 31;
+  h *= 0x94D049BB133111EBull;
+  h ^= h >> 29;
+  return (double)(h >> 11) / (double)(1ull << 52) - 1.0;
+}
+
+//adds a run of instructions of a basic block to an interval's vector
+static void add_block(double* bbv, md_addr_t block, int length) {
+  int d;
+  for (d = 0; d < BBV_DIMS; d++)
+     bbv[d] += length * projection(block, d);
+}
+
+//the projected basic block vector of every interval, normalized by the interval's length.
+//A basic block ends after a control transfer, and at the end of an interval
+static double* profile_intervals(instruction_trace_t* trace, const tom_simpoints_t* sp) {
+  double* bbv = calloc((size_t)sp->intervals * BBV_DIMS, sizeof(double));
+  md_addr_t block = 0;
+  int run = 0;
+  int run_interval = 0;
+  int i;
+  int d;
+  if (!bbv)
+     fatal("out of virtual memory");
+
+  for (i = 1; i <= sp->num_insn; i++) {
+     instruction_t* instr = get_instr(trace, i);
+     int interval = (i - 1) / sp->interval_size;
+     if (run && interval != run_interval) {
+        add_block(&bbv[run_interval * BBV_DIMS], block, run);
+        run = 0;
+     }
+     if (!run) {
+        block = instr->pc;
+        run_interval = interval;
+     }
+     run++;
+     if (MD_OP_FLAGS(instr->op) & F_CTRL) {
+        add_block(&bbv[run_interval * BBV_DIMS], block, run);
+        run = 0;
+     }
+  }
+  if (run)
+     add_block(&bbv[run_interval * BBV_DIMS], block, run);
+
+  for (i = 0; i < sp->intervals; i++) {
+     int length = tom_simpoint_last(sp, i) - tom_simpoint_first(sp, i) + 1;
+     for (d = 0; d < BBV_DIMS; d++)
+        bbv[i * BBV_DIMS + d] /= length;
+  }
+  return bbv;
+}
+
+static double distance2(const double* a, const double* b) {
+  double sum = 0;
+  int d;
+  for (d = 0; d < BBV_DIMS; d++)
+     sum += (a[d] - b[d]) * (a[d] - b[d]);
+  return sum;
+}
+
+//the nearest centroid to a point
+static int nearest(const double* point, const double* centroids, int k) {
+  int best = 0;
+  int c;
+  for (c = 1; c < k; c++) {
+     if (distance2(point, &centroids[c * BBV_DIMS]) < distance2(point, &centroids[best * BBV_DIMS]))
+        best = c;
+  }
+  return best;
+}
+
+//k-means over n points, seeded k-means++ style; fills the centroids and the cluster of every point
+static void kmeans(const double* points, int n, int k, uint32_t* rng, double* centroids, int* cluster) {
+  double* d2 = malloc(n * sizeof(double));
+  int* count = malloc(k * sizeof(int));
+  int c;
+  int i;
+  int d;
+  int iter;
+  if (!d2 || !count)
+     fatal("out of virtual memory");
+
+  //each further seed is a point drawn with probability proportional to its squared distance
+  //to the nearest seed so far
+  memcpy(centroids, &points[(next_random(rng) % n) * BBV_DIMS], BBV_DIMS * sizeof(double));
+  for (c = 1; c < k; c++) {
+     double total = 0;
+     for (i = 0; i < n; i++) {
+        const double* point = &points[i * BBV_DIMS];
+        d2[i] = distance2(point, &centroids[nearest(point, centroids, c) * BBV_DIMS]);
+        total += d2[i];
+     }
+     double pick = total * (next_random(rng) / 4294967296.0);
+     for (i = 0; i < n - 1 && pick >= d2[i]; i++)
+        pick -= d2[i];
+     memcpy(&centroids[c * BBV_DIMS], &points[i * BBV_DIMS], BBV_DIMS * sizeof(double));
+  }
+
+  for (i = 0; i < n; i++)
+     cluster[i] = -1;
+  for (iter = 0; iter < KMEANS_ITERATIONS; iter++) {
+     bool changed = false;
+     for (i = 0; i < n; i++) {
+        c = nearest(&points[i * BBV_DIMS], centroids, k);
+        if (c != cluster[i]) {
+           cluster[i] = c;
+           changed = true;
+        }
+     }
+     if (!changed)
+        break;
+
+     //a cluster left empty keeps its centroid
+     memset(count, 0, k * sizeof(int));
+     for (i = 0; i < n; i++) {
+        if (count[cluster[i]]++ == 0)
+           memset(&centroids[cluster[i] * BBV_DIMS], 0, BBV_DIMS * sizeof(double));
+        for (d = 0; d < BBV_DIMS; d++)
+           centroids[cluster[i] * BBV_DIMS + d] += points[i * BBV_DIMS + d];
+     }
+     for (c = 0; c < k; c++) {
+        for (d = 0; count[c] && d < BBV_DIMS; d++)
+           centroids[c * BBV_DIMS + d] /= count[c];
+     }
+  }
+  free(d2);
+  free(count);
+}
+
+//Bayesian information criterion of a clustering, taking the clusters as spherical Gaussians
+//of a common variance (as in X-means and SimPoint)
+static double bic(const double* points, int n, const double* centroids, int k, const int* cluster) {
+  int* count = calloc(k, sizeof(int));
+  double sse = 0;
+  double loglik = 0;
+  int i;
+  int c;
+  if (!count)
+     fatal("out of virtual memory");
+
+  for (i = 0; i < n; i++) {
+     sse += distance2(&points[i * BBV_DIMS], &centroids[cluster[i] * BBV_DIMS]);
+     count[cluster[i]]++;
+  }
+  double variance = n > k ? sse / ((double)BBV_DIMS * (n - k)) : 0;
+  if (variance < 1e-12)
+     variance = 1e-12;
+
+  for (c = 0; c < k; c++) {
+     if (count[c])
+        loglik += count[c] * log((double)count[c] / n);
+  }
+  loglik -= n * BBV_DIMS / 2.0 * log(TWO_PI * variance) + BBV_DIMS * (n - k) / 2.0;
+  free(count);
+
+  double params = (k - 1) + (double)BBV_DIMS * k + 1;
+  return loglik - params / 2 * log((double)n);
+}
+
+//profiles the instructions [1, num_insn] of the trace and clusters their intervals into at most
+//max_clusters clusters (the BIC picks how many); then picks up to per_cluster intervals of each
+//cluster: the one closest to its centroid, then others at random
+tom_simpoints_t* tom_simpoint_analyze(instruction_trace_t* trace, int num_insn, int interval_size,
+                                      int max_clusters, int per_cluster, unsigned seed) {
+
+  tom_simpoints_t* sp = calloc(1, sizeof(tom_simpoints_t));
+  uint32_t rng = seed ? seed : 1;
+  int i;
+  int k;
+  if (!sp)
+     fatal("out of virtual memory");
+
+  sp->num_insn = num_insn;
+  sp->interval_size = interval_size;
+  sp->intervals = (num_insn + interval_size - 1) / interval_size;
+  double* points = profile_intervals(trace, sp);
+
+  //cluster for every k, and keep the smallest k that scores close to the best
+  int max_k = MIN(max_clusters, sp->intervals);
+  double* centroids = malloc((size_t)max_k * (max_k + 1) / 2 * BBV_DIMS * sizeof(double));
+  int* clusters = malloc((size_t)max_k * sp->intervals * sizeof(int));
+  double* score = malloc(max_k * sizeof(double));
+  if (!centroids || !clusters || !score)
+     fatal("out of virtual memory");
+  for (k = 1; k <= max_k; k++) {
+     double* kc = &centroids[(size_t)k * (k - 1) / 2 * BBV_DIMS];
+     int* kcluster = &clusters[(size_t)(k - 1) * sp->intervals];
+     kmeans(points, sp->intervals, k, &rng, kc, kcluster);
+     score[k - 1] = bic(points, sp->intervals, kc, k, kcluster);
+  }
+  double lowest = score[0];
+  double highest = score[0];
+  for (k = 1; k < max_k; k++) {
+     lowest = MIN(lowest, score[k]);
+     highest = MAX(highest, score[k]);
+  }
+  for (k = 1; k < max_k && score[k - 1] < lowest + BIC_THRESHOLD * (highest - lowest); k++);
+  double* kc = &centroids[(size_t)k * (k - 1) / 2 * BBV_DIMS];
+  int* kcluster = &clusters[(size_t)(k - 1) * sp->intervals];
+
+  //clusters k-means left empty are dropped, so that every cluster has members
+  int* number = malloc(k * sizeof(int));
+  int* closest = malloc(k * sizeof(int));
+  sp->cluster = malloc(sp->intervals * sizeof(int));
+  sp->sample = malloc(sp->intervals * sizeof(int));
+  char* picked = calloc(sp->intervals, 1);
+  if (!number || !closest || !sp->cluster || !sp->sample || !picked)
+     fatal("out of virtual memory");
+  for (i = 0; i < k; i++) {
+     number[i] = -1;
+     closest[i] = -1;
+  }
+  for (i = 0; i < sp->intervals; i++) {
+     int c = kcluster[i];
+     if (number[c] == -1)
+        number[c] = sp->clusters++;
+     sp->cluster[i] = number[c];
+     if (closest[c] == -1
+         || distance2(&points[i * BBV_DIMS], &kc[c * BBV_DIMS])
+            < distance2(&points[closest[c] * BBV_DIMS], &kc[c * BBV_DIMS]))
+        closest[c] = i;
+  }
+
+  //the representative of each cluster, then random other members while there are some left
+  for (i = 0; i < k; i++) {
+     if (closest[i] != -1)
+        picked[closest[i]] = 1;
+  }
+  for (i = 0; i < k; i++) {
+     if (closest[i] == -1)
+        continue;
+     int c = number[i];
+     int left = -1;
+     int j;
+     for (j = 0; j < sp->intervals; j++)
+        left += sp->cluster[j] == c;
+     int n;
+     for (n = 1; n < per_cluster && left > 0; n++, left--) {
+        int skip = next_random(&rng) % left;
+        for (j = 0; j < sp->intervals; j++) {
+           if (sp->cluster[j] == c && !picked[j] && skip-- == 0)
+              break;
+        }
+        picked[j] = 1;
+     }
+  }
+  for (i = 0; i < sp->intervals; i++) {
+     if (picked[i])
+        sp->sample[sp->samples++] = i;
+  }
+
+  free(points);
+  free(centroids);
+  free(clusters);
+  free(score);
+  free(number);
+  free(closest);
+  free(picked);
+  return sp;
+}
+
+//first and last instruction index of an interval
+int tom_simpoint_first(const tom_simpoints_t* sp, int interval) {
+  return interval * sp->interval_size + 1;
+}
+
+int tom_simpoint_last(const tom_simpoints_t* sp, int interval) {
+  return MIN((interval + 1) * sp->interval_size, sp->num_insn);
+}
+
+void tom_simpoint_free(tom_simpoints_t* sp) {
+  if (!sp)
+     return;
+  free(sp->cluster);
+  free(sp->sample);
+  free(sp);
+}
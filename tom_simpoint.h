@@ -0,0 +1,33 @@
+#ifndef TOM_SIMPOINT_H
+#define TOM_SIMPOINT_H
+
+#include "instr.h"
+
+//SimPoint-style interval selection: the trace is cut into intervals of a fixed number of
+//instructions, each described by its basic block vector (the share of the interval every
+//basic block takes, randomly projected to a few dimensions), and the intervals are clustered
+//with k-means. A few intervals of each cluster then stand for all of them
+typedef struct tom_simpoints
+{
+  int num_insn;        //instructions profiled, from index 1
+  int interval_size;   //instructions per interval (the last one may be shorter)
+  int intervals;       //intervals in the trace
+  int clusters;        //clusters the intervals fell into
+  int* cluster;        //cluster of each interval
+  int samples;         //intervals picked for detailed simulation
+  int* sample;         //the picked intervals, in trace order
+}tom_simpoints_t;
+
+//profiles the instructions [1, num_insn] of the trace and clusters their intervals into at most
+//max_clusters clusters (the BIC picks how many); then picks up to per_cluster intervals of each
+//cluster: the one closest to its centroid, then others at random
+extern tom_simpoints_t* tom_simpoint_analyze(instruction_trace_t* trace, int num_insn, int interval_size,
+                                             int max_clusters, int per_cluster, unsigned seed);
+
+//first and last instruction index of an interval
+extern int tom_simpoint_first(const tom_simpoints_t* sp, int interval);
+extern int tom_simpoint_last(const tom_simpoints_t* sp, int interval);
+
+extern void tom_simpoint_free(tom_simpoints_t* sp);
+
+#endif
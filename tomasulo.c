@@ -4,7 +4,11 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <math.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "host.h"
 #include "misc.h"
@@ -20,18 +24,82 @@
 #include "decode.def"
 
 #include "instr.h"
+#include "tom_bpred.h"
+#include "tom_cache.h"
+#include "tom_occupancy.h"
+#include "tom_pipeview.h"
+#include "tom_simpoint.h"
+#include "tomasulo.h"
 
 /* PARAMETERS OF THE TOMASULO'S ALGORITHM */
 
+//defaults; every parameter can be changed at runtime (see tomasulo_reg_options)
 #define INSTR_QUEUE_SIZE         10
 
 #define RESERV_INT_SIZE    4
 #define RESERV_FP_SIZE     2
-#define FU_INT_SIZE        2
-#define FU_FP_SIZE         1
 
-#define FU_INT_LATENCY     4
-#define FU_FP_LATENCY      9
+#define FETCH_WIDTH        1
+#define DISPATCH_WIDTH     1
+#define CDB_COUNT          1
+
+#define LSQ_SIZE           0  //no load/store queue
+#define LSQ_FWD_LATENCY    1
+
+#define ROB_SIZE           0  //no reorder buffer
+#define PRF_SIZE           0  //renaming is only limited by the reservation stations
+#define BPRED_KIND         "perfect"
+#define BPRED_BITS         12
+#define BPRED_PENALTY      3
+
+//largest structures the machine can be configured with
+#define INSTR_QUEUE_MAX_SIZE     1024
+#define RS_MAX_SIZE        256
+#define FU_MAX_SIZE        64
+#define WIDTH_MAX          64
+#define CDB_MAX_COUNT      16
+#define LSQ_MAX_SIZE       256
+#define ROB_MAX_SIZE       1024
+
+//64-bit words in a wakeup/select mask
+#define RS_MASK_WORDS      ((RS_MAX_SIZE + 63) / 64)
+
+//most machine configurations a single sweep can simulate
+#define SWEEP_MAX_CONFIGS  64
+
+//most per-opcode latency overrides
+#define OP_LAT_MAX_SPECS   64
+
+//functional unit types; each executes the opcodes of one SimpleScalar FU class
+enum fu_pool { FU_INT, FU_MUL, FU_DIV, FU_FP, FU_FPMUL, FU_FPDIV, NUM_FU_POOLS };
+
+//a set of identical functional units
+typedef struct tom_fu_pool
+{
+  int count;     //units; 0 runs the pool's opcodes on the INT or FP units instead
+  int latency;   //cycles from entering execute to the result being ready
+  int interval;  //cycles before a unit accepts the next instruction, 0 if it is busy until the CDB
+}tom_fu_pool_t;
+
+//the structural parameters of the simulated machine
+typedef struct tom_config
+{
+  int ifq_size;        //instruction queue entries
+  int rs_int_size;     //INT reservation station entries
+  int rs_fp_size;      //FP reservation station entries
+  int fetch_width;     //instructions fetched per cycle
+  int dispatch_width;  //instructions dispatched per cycle
+  int num_cdb;         //common data buses (broadcasts per cycle)
+  int lsq_size;        //load/store queue entries, 0 to order memory operations through registers only
+  int lsq_fwd_latency; //cycles a load takes when a store forwards its data
+  int rob_size;        //reorder buffer entries, 0 if instructions leave the machine from the CDB
+  int prf_size;        //physical registers, architectural ones included; 0 for no limit
+  int bpred;           //enum tom_bpred_kind
+  int bpred_bits;      //log2 of the entries in each predictor table
+  int bpred_penalty;   //cycles between a mispredicted branch resolving and fetch restarting
+  tom_fu_pool_t fu[NUM_FU_POOLS];  //functional units, by enum fu_pool
+  tom_cache_config_t cache;        //data memory hierarchy
+}tom_config_t;
 
 /* IDENTIFYING INSTRUCTIONS */
 
@@ -80,148 +148,1149 @@
   md_print_insn(instr->inst, instr->pc, out); \
   myfprintf(stdout, "(%d)\n",instr->index);
 
-/* VARIABLES */
+//the per-cycle code is always inlined into the configuration-specialized loops below,
+//so that their structure sizes become constants the compiler can unroll over
+#define TOM_STAGE static inline __attribute__((always_inline))
 
-//instruction queue for tomasulo
-static instruction_t* instr_queue[INSTR_QUEUE_SIZE];
-//number of instructions in the instruction queue
-static int instr_queue_size = 0;
+/* MACHINE STATE */
 
-//reservation stations (each reservation station entry contains a pointer to an instruction)
-static instruction_t* reservINT[RESERV_INT_SIZE];
-static instruction_t* reservFP[RESERV_FP_SIZE];
+//reservation station classes
+enum rs_class { RS_INT, RS_FP, NUM_RS_CLASSES };
 
-//functional units
-static instruction_t* fuINT[FU_INT_SIZE];
-static instruction_t* fuFP[FU_FP_SIZE];
+//loads and stores conflict when they touch the same aligned 8-byte word
+#define LSQ_WORD(addr) ((addr) >> 3)
 
-//common data bus
-static instruction_t* commonDataBus = NULL;
+//what the load/store queue lets a load do
+enum lsq_status
+{
+  LSQ_CLEAR,    //no older store is still in flight
+  LSQ_BYPASS,   //executes ahead of older stores to other addresses
+  LSQ_FORWARD,  //takes its data from an older store to the same address
+  LSQ_BLOCKED   //waits for an older store to the same word
+};
+
+//a load or store in the load/store queue; a store that has left the machine stays in the
+//queue (as in a store buffer) and keeps forwarding its data until every older entry has left
+typedef struct lsq_entry
+{
+  int entry;        //its INT reservation station entry, -1 once it has left the machine
+  bool store;
+  md_addr_t addr;   //effective address, from the trace
+  int done;         //stores that left: cycle their data was ready
+  int wait_until;   //loads: cycle the conflicting stores that already left stopped holding it back
+}lsq_entry_t;
+
+//why fetch took no instruction in a cycle (it also stops once the trace is exhausted)
+enum fetch_stall { FETCH_IFQ_FULL, FETCH_REDIRECT, NUM_FETCH_STALLS };
+
+//why dispatch took no instruction in a cycle
+enum dispatch_stall
+{
+  DISPATCH_IFQ_EMPTY,
+  DISPATCH_RS_INT_FULL,
+  DISPATCH_RS_FP_FULL,
+  DISPATCH_LSQ_FULL,
+  DISPATCH_ROB_FULL,
+  DISPATCH_PRF_EMPTY,
+  NUM_DISPATCH_STALLS
+};
+
+//why an issued instruction had not started executing in a cycle
+enum execute_stall { EXECUTE_OPERANDS, EXECUTE_FU_BUSY, NUM_EXECUTE_STALLS };
+
+//CPI stack: each cycle dispatches (base) or is blamed on what holds dispatch up. A full
+//structure is blamed on the state of its oldest instruction
+enum cpi_component
+{
+  CPI_BASE,      //dispatched an instruction
+  CPI_FRONTEND,  //nothing to dispatch yet (cycle 0)
+  CPI_BRANCH,    //nothing to dispatch behind a mispredicted branch
+  CPI_OPERANDS,  //oldest instruction waits for its operands (or for an older store)
+  CPI_FU_BUSY,   //oldest instruction is ready, its functional units are all busy
+  CPI_EXECUTE,   //oldest instruction is executing
+  CPI_CDB,       //oldest instruction has finished: it is on a CDB or lost it
+  CPI_COMMIT,    //oldest instruction has completed and waits to commit
+  CPI_DRAIN,     //the whole trace has been dispatched
+  NUM_CPI_COMPONENTS
+};
+
+//event counts of a run, reported through the simulator statistics
+typedef struct tom_stats
+{
+  counter_t loads_forwarded;  //loads that took their data from an older store
+  counter_t loads_bypassed;   //loads that executed ahead of older stores to other addresses
+  counter_t loads_stalled;    //loads held back by an older store to the same word
+  counter_t cond_branches;    //conditional branches fetched
+  counter_t mispredicts;      //of those, the ones the predictor got wrong
+  tom_cache_stats_t cache;    //data memory hierarchy
+
+  //stall cycles of each stage by cause (summed over the instructions from execute on),
+  //and the CPI stack in cycles
+  counter_t fetch_stalls[NUM_FETCH_STALLS];
+  counter_t dispatch_stalls[NUM_DISPATCH_STALLS];
+  counter_t execute_stalls[NUM_EXECUTE_STALLS];
+  counter_t cdb_lost;         //cycles finished instructions spent waiting for a CDB
+  counter_t cpi[NUM_CPI_COMPONENTS];
+}tom_stats_t;
+
+//how each functional unit type is named in the options, and where its defaults come from
+typedef struct fu_pool_desc
+{
+  const char *name;      //in the sweep specs and the tables
+  int rs_class;          //reservation station its instructions wait in
+  int base;              //pool that runs its instructions when it has no units
+  tom_fu_pool_t defaults;
+  const char *count_opt, *latency_opt, *interval_opt;
+}fu_pool_desc_t;
+
+//the defaults are the lab machine: 2 INT units and 1 FP unit, unpipelined. The original
+//simulator timed the INT units with the FP latency, so they take 9 cycles too; -tom:int_lat 4
+//(and -tom:mul_lat, -tom:div_lat) gives them the 4 cycles the lab describes
+static const fu_pool_desc_t fu_pools[NUM_FU_POOLS] = {
+  { "int",   RS_INT, FU_INT, { 2, 9, 0 }, "-tom:fu_int",   "-tom:int_lat",   "-tom:int_ii"   },
+  { "mul",   RS_INT, FU_INT, { 0, 9, 0 }, "-tom:fu_mul",   "-tom:mul_lat",   "-tom:mul_ii"   },
+  { "div",   RS_INT, FU_INT, { 0, 9, 0 }, "-tom:fu_div",   "-tom:div_lat",   "-tom:div_ii"   },
+  { "fp",    RS_FP,  FU_FP,  { 1, 9, 0 }, "-tom:fu_fp",    "-tom:fp_lat",    "-tom:fp_ii"    },
+  { "fpmul", RS_FP,  FU_FP,  { 0, 9, 0 }, "-tom:fu_fpmul", "-tom:fpmul_lat", "-tom:fpmul_ii" },
+  { "fpdiv", RS_FP,  FU_FP,  { 0, 9, 0 }, "-tom:fu_fpdiv", "-tom:fpdiv_lat", "-tom:fpdiv_ii" },
+};
+
+//reservation station class of each pool, as a constant the cycle code can fold
+static const int fu_pool_class[NUM_FU_POOLS] = { RS_INT, RS_INT, RS_INT, RS_FP, RS_FP, RS_FP };
+
+//a parameter of the data memory hierarchy; sweep specs name it like its option, without "-tom:"
+typedef struct cache_param_desc
+{
+  const char *opt;
+  const char *desc;
+  int def;
+  size_t offset;         //of its field in tom_cache_config_t
+}cache_param_desc_t;
+
+//the defaults leave the caches off; turning the L1D on gives a 256KB L2 and 100-cycle memory behind it
+static const cache_param_desc_t cache_params[] = {
+  { "-tom:l1d_kb",     "L1 data cache size in KB (0: no caches, loads take their unit's latency)",
+    0, offsetof(tom_cache_config_t, l1d_kb) },
+  { "-tom:l1d_assoc",  "L1 data cache associativity", 4, offsetof(tom_cache_config_t, l1d_assoc) },
+  { "-tom:l1d_lat",    "L1 data cache hit latency (cycles)", 2, offsetof(tom_cache_config_t, l1d_latency) },
+  { "-tom:l2_kb",      "L2 cache size in KB (0: L1 misses go to memory)", 256,
+    offsetof(tom_cache_config_t, l2_kb) },
+  { "-tom:l2_assoc",   "L2 cache associativity", 8, offsetof(tom_cache_config_t, l2_assoc) },
+  { "-tom:l2_lat",     "cycles an L2 hit adds to an L1 miss", 10, offsetof(tom_cache_config_t, l2_latency) },
+  { "-tom:mem_lat",    "cycles memory adds to an L2 miss", 100, offsetof(tom_cache_config_t, mem_latency) },
+  { "-tom:line_size",  "cache line size (bytes)", 64, offsetof(tom_cache_config_t, line_size) },
+  { "-tom:mshrs",      "L1 data cache misses that can be outstanding", 8,
+    offsetof(tom_cache_config_t, mshrs) },
+};
+#define NUM_CACHE_PARAMS ((int)(sizeof(cache_params) / sizeof(cache_params[0])))
+
+//the field of a configuration a cache parameter sets
+#define CACHE_PARAM(cfg, i) ((int *)((char *)&(cfg)->cache + cache_params[i].offset))
+
+//largest number of MSHRs
+#define MSHR_MAX_COUNT     64
+
+//the cycles an instruction entered each stage in
+typedef struct tom_timing
+{
+  int dispatch;
+  int issue;
+  int execute;
+  int cdb;
+  int commit;
+}tom_timing_t;
+
+//an instruction in the reorder buffer
+typedef struct rob_entry
+{
+  int index;            //its trace index
+  tom_timing_t timing;  //its stage cycles, once it has left the reservation stations
+  int ready;            //first cycle it can commit in, INT_MAX until it completes
+  int regs;             //physical registers its commit frees
+}rob_entry_t;
+
+//a reservation station with wakeup/select state kept as bitmasks over its entries
+typedef struct reservation_station
+{
+  int count;  //number of occupied entries
+  int oldest; //oldest occupied entry, -1 if it has not been looked up since the last one left
+
+  int index[RS_MAX_SIZE];                      //trace index of the instruction in each entry
+  int8_t r_out[RS_MAX_SIZE][NUM_OUTPUT_REGS]; //its output registers
+  tom_timing_t timing[RS_MAX_SIZE];           //its stage cycles
+  int pending[RS_MAX_SIZE];                   //number of producer tags the entry still waits for
+  uint8_t pool[RS_MAX_SIZE];                  //functional unit pool it executes on
+  uint8_t unit[RS_MAX_SIZE];                  //unit of the pool, once executing
+  int latency[RS_MAX_SIZE];                   //cycles its opcode takes to execute
+  int done[RS_MAX_SIZE];                      //cycle its result is ready, once executing
+  int ready_cycle[RS_MAX_SIZE];               //first cycle it could execute, once ready
+  int lsq[RS_MAX_SIZE];                       //its load/store queue slot, -1 if it has none
+  int rob[RS_MAX_SIZE];                       //its reorder buffer slot
+  md_addr_t addr[RS_MAX_SIZE];                //effective address of a load or store
+
+  uint64_t valid[RS_MASK_WORDS];     //occupied entries
+  uint64_t unissued[RS_MASK_WORDS];  //dispatched, not yet issued
+  uint64_t fresh[RS_MASK_WORDS];     //issued in the current cycle
+  uint64_t ready[RS_MASK_WORDS];     //issued with all operands, waiting for a functional unit
+  uint64_t executing[RS_MASK_WORDS]; //in a functional unit, waiting for its result and the CDB
+
+  //entries executing on each functional unit pool
+  uint64_t in_pool[NUM_FU_POOLS][RS_MASK_WORDS];
+
+  //age matrix: bit j of older[i] is set if entry j holds an older instruction than entry i
+  uint64_t older[RS_MAX_SIZE][RS_MASK_WORDS];
+
+  //consumers of each entry's result, per reservation station class
+  uint64_t wakeup[RS_MAX_SIZE][NUM_RS_CLASSES][RS_MASK_WORDS];
+}rs_t;
+
+//one simulated Tomasulo machine; the trace it runs over is shared and only read.
+//Instructions are referred to by their trace index; the scheduler reads their instr_hot_t, and
+//the rest of instruction_t only for a branch's pc at fetch and a load or store's address at dispatch
+typedef struct tom_machine
+{
+  const tom_config_t *cfg;     //structure sizes and latencies
+  instruction_trace_t *trace;  //instruction trace with all the instructions executed
+  counter_t num_insn;          //number of instructions in the trace
+
+  bool writeback;              //store every instruction's stage cycles in the trace
+  tom_timing_t *timing_log;    //if not NULL, also record them here, by instruction index
+  int log_first;               //from this index on (timing_log[0] is its entry)
+  bool progress;               //print the cycle every 100 cycles
+
+  //instruction queue for tomasulo (a circular buffer; the oldest instruction is at instr_queue_head)
+  int instr_queue[INSTR_QUEUE_MAX_SIZE];
+  //slot of the oldest instruction in the instruction queue
+  int instr_queue_head;
+  //number of instructions in the instruction queue
+  int instr_queue_size;
+
+  //reservation stations
+  rs_t reserv[NUM_RS_CLASSES];
+
+  //functional units: the first cycle each unit of each pool can start an instruction
+  //(INT_MAX while an unpipelined unit holds an instruction that has not reached the CDB)
+  int fu_next[NUM_FU_POOLS][FU_MAX_SIZE];
+
+  //pool and latency of every opcode, for this configuration
+  uint8_t op_pool[OP_MAX];
+  int op_latency[OP_MAX];
+
+  //common data buses in use this cycle: the index of the instruction on each, and its reservation station tag
+  int commonDataBus[CDB_MAX_COUNT];
+  int commonDataBus_tag[CDB_MAX_COUNT];
+  int commonDataBus_count;
+
+  //load/store queue in program order (a circular buffer; slots of instructions that left stay
+  //occupied until every older one has left too)
+  lsq_entry_t lsq[LSQ_MAX_SIZE];
+  int lsq_head;
+  int lsq_size;
+
+  //reorder buffer in program order (a circular buffer)
+  rob_entry_t rob[ROB_MAX_SIZE];
+  int rob_head;
+  int rob_count;
+
+  //branch prediction: fetch stops after a mispredicted branch until fetch_resume
+  //(INT_MAX until the branch resolves, once its operands are ready)
+  tom_bpred_t *bpred;
+  int fetch_resume;
+  int mispredict_index;        //trace index of the mispredicted branch not dispatched yet, -1 if none
+  int mispredict_rob;          //its reorder buffer slot
+  int branch_wait[NUM_INPUT_REGS];  //producer tags the dispatched mispredicted branch waits for
+  int branch_waiting;
+
+  //data caches, NULL without an L1D
+  tom_cache_t *dcache;
+
+  tom_stats_t stats;
+  int cycle;                   //last cycle simulated
+
+  //occupancy sampler, NULL unless -tom:occupancy or -tom:occ_out asks for one
+  tom_occupancy_t *occupancy;
+
+  //The map table keeps track of which reservation station entry (tag) produces the value for each register
+  //(-1 if the value is in the register file)
+  int map_table[MD_TOTAL_REGS];
+
+  //with a physical register file, the free list, as its length: every renamed destination
+  //takes a register from it and gives back the one it replaced when it commits. Which
+  //register that is never changes the timing, so only the count is kept
+  int prf_free;
+
+  //the index of the last instruction fetched
+  int fetch_index;
+  //number of instructions fetched so far
+  int fetch_count;
+
+  //streaming mode (see tomasulo_stream_begin); the trace is a sliding window of the run
+  bool streaming;
+  bool print_table;            //print each instruction's row as it leaves the window
+  tom_pipeview_t *pipeview;    //and export its stages to this pipeline viewer file, if not NULL
+  int stream_fetchable;        //number of instructions produced that fetch would take
+  int flush_index;             //oldest instruction still in the window
+  uint8_t *retired;            //ring of per-instruction flags: has left the machine
+  int retired_size;            //entries in the ring (a power of two)
+}tom_machine_t;
+
+#define RS_TAG(cls, entry) ((cls) * RS_MAX_SIZE + (entry))
+#define TAG_CLASS(tag)     ((tag) / RS_MAX_SIZE)
+#define TAG_ENTRY(tag)     ((tag) % RS_MAX_SIZE)
 
-//The map table keeps track of which instruction produces the value for each register
-static instruction_t* map_table[MD_TOTAL_REGS];
+/* VARIABLES */
 
-//the index of the last instruction fetched
-static int fetch_index = 0;
+//the machine being simulated, as set by the options
+static tom_config_t machine_config;
+
+/* SIMULATION MODES */
+
+//skip cycles in which no stage can change the machine state
+static int tom_skip_cycles = TRUE;
+//run both the per-cycle and the cycle-skipping loop and compare their results
+static int tom_check_skip = FALSE;
+//run the reference model alongside the machine and compare their results
+static int tom_check_ref = FALSE;
+
+//print the cycle every 100 cycles
+int tomasulo_progress = TRUE;
+
+//in streaming mode, simulate on a thread of its own, fed through a ring of this many
+//instructions, so that the functional simulator runs alongside
+static int stream_threaded = FALSE;
+static int stream_ring_size = 4096;
+
+//extra machine configurations simulated over the same trace, and the threads to use (for the
+//-tom:parallel chunks too)
+static char *sweep_specs[SWEEP_MAX_CONFIGS];
+static int sweep_num_specs = 0;
+static int sweep_threads = 1;
+
+//the statistics of the last run (of its base configuration, in a sweep)
+static tom_stats_t tom_stats;
+
+//sampled simulation: instructions per interval (0: simulate the whole trace in detail), most
+//clusters, intervals simulated per cluster, instructions simulated in detail before each one,
+//and the seed of the random picks
+static int simpoint_interval = 0;
+static int simpoint_max_k = 10;
+static int simpoint_per_cluster = 2;
+static int simpoint_warmup = 10000;
+static int simpoint_seed = 1;
+
+//prefix of the checkpoint files written at the start of every sampled interval, and a
+//checkpoint to simulate the interval of on its own
+static char *simpoint_ckpt_prefix = NULL;
+static char *simpoint_restore_path = NULL;
+
+//interval-parallel simulation: chunks of the trace simulated on the sweep threads (0: off),
+//instructions each chunk is warmed up on, and whether to measure the error against a serial run
+static int parallel_chunks = 0;
+static int parallel_warmup = 10000;
+static int parallel_check = FALSE;
+
+//-tom:bpred, the name of the branch predictor
+static char *bpred_option = BPRED_KIND;
+
+//trace file to replay instead of running the functional simulator
+static char *trace_in_path = NULL;
+
+//occupancy histograms, and the file and interval of the occupancy time series
+static int tom_occupancy = FALSE;
+static char *occ_out_path = NULL;
+static int occ_interval = 10000;
+static int occ_binary = FALSE;
+
+//-tom:table, how the Tomasulo table is written, and the window of instructions it prints
+static char *table_option = "text";
+static int table_insts[2];
+static int table_num_insts = 0;
+
+//pipeline viewer file, its format, and the windows of instruction indices and cycles it takes
+static char *pipe_out_path = NULL;
+static char *pipe_format_option = "konata";
+static int pipe_insts[2];
+static int pipe_num_insts = 0;
+static int pipe_cycles[2];
+static int pipe_num_cycles = 0;
+
+//the occupancy statistics of the last run: a distribution and a mean per structure
+//of the base configuration, registered when sampling is on
+static int occ_num_stats = 0;
+static int occ_capacity[TOM_OCC_MAX_COLUMNS];
+static struct stat_stat_t *occ_dists[TOM_OCC_MAX_COLUMNS];
+static double occ_means[TOM_OCC_MAX_COLUMNS];
+
+//"opcode=cycles" latencies that override the latency of the opcode's functional unit
+static char *op_lat_specs[OP_LAT_MAX_SPECS];
+static int op_lat_num_specs = 0;
+
+//the latency each opcode is overridden to, 0 if it takes its unit's latency
+static int op_lat_override[OP_MAX];
 
 /* FUNCTIONAL UNITS */
 
+//functional unit pool an opcode belongs to, in the reservation station class it is dispatched to
+static int fu_pool_of(enum md_opcode op, int cls) {
+  int pool;
+  switch (MD_OP_FUCLASS(op)) {
+  case IntMULT:   pool = FU_MUL; break;
+  case IntDIV:    pool = FU_DIV; break;
+  case FloatMULT: pool = FU_FPMUL; break;
+  case FloatDIV:
+  case FloatSQRT: pool = FU_FPDIV; break;
+  default:        pool = cls == RS_FP ? FU_FP : FU_INT; break;
+  }
+  return fu_pools[pool].rs_class == cls ? pool : (cls == RS_FP ? FU_FP : FU_INT);
+}
+
+//fills in the pool each opcode executes on and its latency, for a configuration
+static void build_op_tables(tom_machine_t *m, const tom_config_t *cfg) {
+  int op;
+  for (op = 0; op < OP_MAX; op++) {
+    int pool = fu_pool_of(op, IS_FCOMP(op) ? RS_FP : RS_INT);
+    m->op_latency[op] = op_lat_override[op] ? op_lat_override[op] : cfg->fu[pool].latency;
+    m->op_pool[op] = cfg->fu[pool].count ? pool : fu_pools[pool].base;
+  }
+}
+
+//reads the -tom:op_lat overrides into op_lat_override
+static void parse_op_latencies(void) {
+  int i;
+  memset(op_lat_override, 0, sizeof(op_lat_override));
+  for (i = 0; i < op_lat_num_specs; i++) {
+    char name[64];
+    int cycles;
+    int op;
+    if (sscanf(op_lat_specs[i], "%63[^=]=%d", name, &cycles) != 2 || cycles < 1)
+      fatal("bad opcode latency `%s' (expected opcode=cycles)", op_lat_specs[i]);
+
+    for (op = 1; op < OP_MAX; op++) {
+      if (!mystricmp(MD_OP_NAME(op), name))
+        break;
+    }
+    if (op == OP_MAX)
+      fatal("unknown opcode `%s' in `%s'", name, op_lat_specs[i]);
+    op_lat_override[op] = cycles;
+  }
+}
 
 /* RESERVATION STATIONS */
 
-int push_to_IFQ(instruction_t *instr) {
-    int i = 0;
-    for(; i < INSTR_QUEUE_SIZE; i++) {
-        if(instr_queue[i] == NULL) {
-            instr_queue[i] = instr;
-            return 1;
+//slot of the i-th oldest instruction in the instruction queue
+TOM_STAGE int IFQ_slot(tom_machine_t *m, const tom_config_t *cfg, int i) {
+    int slot = m->instr_queue_head + i;
+    return slot >= cfg->ifq_size ? slot - cfg->ifq_size : slot;
+}
+
+TOM_STAGE int push_to_IFQ(tom_machine_t *m, const tom_config_t *cfg, int index) {
+    if(m->instr_queue_size == cfg->ifq_size) return 0;
+
+    m->instr_queue[IFQ_slot(m, cfg, m->instr_queue_size)] = index;
+    m->instr_queue_size++;
+    return 1;
+}
+
+//oldest instruction in the instruction queue, -1 if it is empty
+TOM_STAGE int peek_IFQ(tom_machine_t *m) {
+    return m->instr_queue_size == 0 ? -1 : m->instr_queue[m->instr_queue_head];
+}
+
+TOM_STAGE int pop_from_IFQ(tom_machine_t *m, const tom_config_t *cfg) {
+    if(m->instr_queue_size == 0) return -1;
+
+    int index = m->instr_queue[m->instr_queue_head];
+    m->instr_queue_head = IFQ_slot(m, cfg, 1);
+    m->instr_queue_size--;
+    
+    return index;
+}
+
+/* LOAD/STORE QUEUE */
+
+//slot of the i-th oldest instruction in the load/store queue
+TOM_STAGE int LSQ_slot(tom_machine_t *m, const tom_config_t *cfg, int i) {
+    int slot = m->lsq_head + i;
+    return slot >= cfg->lsq_size ? slot - cfg->lsq_size : slot;
+}
+
+//true if the instruction needs a load/store queue slot and there is none
+TOM_STAGE bool lsq_full(tom_machine_t *m, const tom_config_t *cfg, const instr_hot_t *hot) {
+    return cfg->lsq_size && (hot->flags & (INSTR_LOAD | INSTR_STORE)) && m->lsq_size == cfg->lsq_size;
+}
+
+//appends the load or store in an INT reservation station entry to the load/store queue; returns its slot
+TOM_STAGE int lsq_insert(tom_machine_t *m, const tom_config_t *cfg, int e, const instr_hot_t *hot) {
+    int slot = LSQ_slot(m, cfg, m->lsq_size);
+    lsq_entry_t *entry = &m->lsq[slot];
+
+    entry->entry = e;
+    entry->store = (hot->flags & INSTR_STORE) != 0;
+    entry->addr = m->reserv[RS_INT].addr[e];
+    entry->wait_until = 0;
+    m->lsq_size++;
+    return slot;
+}
+
+/* REORDER BUFFER */
+
+//slot of the i-th oldest instruction in the reorder buffer
+TOM_STAGE int ROB_slot(tom_machine_t *m, const tom_config_t *cfg, int i) {
+    int slot = m->rob_head + i;
+    return slot >= cfg->rob_size ? slot - cfg->rob_size : slot;
+}
+
+//true if the machine has a reorder buffer and it is full
+TOM_STAGE bool rob_full(tom_machine_t *m, const tom_config_t *cfg) {
+    return cfg->rob_size && m->rob_count == cfg->rob_size;
+}
+
+//appends an instruction that has not completed to the reorder buffer; returns its slot
+TOM_STAGE int rob_insert(tom_machine_t *m, const tom_config_t *cfg, int index) {
+    int slot = ROB_slot(m, cfg, m->rob_count);
+
+    m->rob[slot].index = index;
+    m->rob[slot].ready = INT_MAX;
+    m->rob[slot].regs = 0;
+    m->rob_count++;
+    return slot;
+}
+
+/* PHYSICAL REGISTER FILE */
+
+//number of destinations an instruction renames ($0 is never written)
+TOM_STAGE int prf_dests(const int8_t *r_outs) {
+    int i;
+    int dests = 0;
+    for(i = 0; i < NUM_OUTPUT_REGS; i++) {
+        if(r_outs[i] != -1 && r_outs[i] != 0) dests++;
+    }
+    return dests;
+}
+
+//true if the machine has a physical register file and too few free registers for the instruction
+TOM_STAGE bool prf_short(tom_machine_t *m, const tom_config_t *cfg, const instr_hot_t *hot) {
+    return cfg->prf_size && m->prf_free < prf_dests(hot->r_out);
+}
+
+/* ENTRY MASKS */
+
+static inline void mask_set(uint64_t *mask, int i) { mask[i >> 6] |= (uint64_t)1 << (i & 63); }
+static inline void mask_clear(uint64_t *mask, int i) { mask[i >> 6] &= ~((uint64_t)1 << (i & 63)); }
+static inline bool mask_test(const uint64_t *mask, int i) { return (mask[i >> 6] >> (i & 63)) & 1; }
+
+static inline bool mask_any(const uint64_t *mask, int words) {
+    int w;
+    for(w = 0; w < words; w++) {
+        if(mask[w]) return true;
+    }
+    return false;
+}
+
+//true if the two masks share a set bit
+static inline bool mask_any_both(const uint64_t *a, const uint64_t *b, int words) {
+    int w;
+    for(w = 0; w < words; w++) {
+        if(a[w] & b[w]) return true;
+    }
+    return false;
+}
+
+//visits every set bit of a mask as 'i', lowest first
+#define FOR_EACH_BIT(i, mask, words)                                     \
+    for(int _w = 0; _w < (words); _w++)                                  \
+        for(uint64_t _bits = (mask)[_w];                                 \
+            _bits && ((i) = (_w << 6) + __builtin_ctzll(_bits), 1);      \
+            _bits &= _bits - 1)
+
+//number of entries in a reservation station
+TOM_STAGE int rs_size(const tom_config_t *cfg, int cls) {
+    return cls == RS_FP ? cfg->rs_fp_size : cfg->rs_int_size;
+}
+
+//64-bit words covering the entries of a reservation station
+TOM_STAGE int rs_words(const tom_config_t *cfg, int cls) {
+    return (rs_size(cfg, cls) + 63) / 64;
+}
+
+//reservation station class an instruction goes to
+static inline int rs_class_of(const instr_hot_t *hot) {
+    return hot->cls == INSTR_CLASS_FP ? RS_FP : RS_INT;
+}
+
+/* 
+ * Description: 
+ * 	Places an instruction in a free reservation station entry, reads its operand tags
+ *      from the map table and registers it as a consumer of the entries it waits for
+ * Inputs:
+ * 	cls: reservation station class
+ * 	index: trace index of the instruction being dispatched
+ * 	hot: its scheduling fields
+ * Returns:
+ * 	The entry the instruction was placed in, -1 if the station is full
+ */
+TOM_STAGE int rs_insert(tom_machine_t *m, const tom_config_t *cfg, int cls, int index, const instr_hot_t *hot) {
+    rs_t *rs = &m->reserv[cls];
+    int words = rs_words(cfg, cls);
+    int e = -1;
+    int i;
+    int w;
+
+    if(rs->count == rs_size(cfg, cls)) return -1;
+
+    //lowest free entry
+    for(w = 0; w < words; w++) {
+        if(~rs->valid[w]) {
+            e = (w << 6) + __builtin_ctzll(~rs->valid[w]);
+            break;
         }
     }
-    
-    return 0;
+
+    //everything already in the station is older; nothing is younger yet
+    FOR_EACH_BIT(i, rs->valid, words) mask_clear(rs->older[i], e);
+    memcpy(rs->older[e], rs->valid, sizeof(rs->older[e]));
+
+    rs->index[e] = index;
+    rs->r_out[e][0] = hot->r_out[0];
+    rs->r_out[e][1] = hot->r_out[1];
+    memset(&rs->timing[e], 0, sizeof(rs->timing[e]));
+    rs->pool[e] = m->op_pool[hot->op];
+    rs->latency[e] = m->op_latency[hot->op];
+    rs->lsq[e] = -1;
+    if(hot->flags & (INSTR_LOAD | INSTR_STORE)) rs->addr[e] = get_instr(m->trace, index)->mem_addr;
+    rs->count++;
+    mask_set(rs->valid, e);
+    mask_set(rs->unissued, e);
+    mask_set(rs->in_pool[rs->pool[e]], e);
+
+    //Set RAW HAZARDS (an entry waits once per producer, however many operands it supplies)
+    rs->pending[e] = 0;
+    for(i = 0; i < NUM_INPUT_REGS; i++) {
+        int tag = hot->r_in[i] != -1 ? m->map_table[hot->r_in[i]] : -1;
+        if(tag == -1) continue;
+
+        uint64_t *consumers = m->reserv[TAG_CLASS(tag)].wakeup[TAG_ENTRY(tag)][cls];
+        if(!mask_test(consumers, e)) {
+            mask_set(consumers, e);
+            rs->pending[e]++;
+        }
+    }
+
+    return e;
 }
 
+/*
+ * Description:
+ * 	Takes a load or store that has left the machine out of the load/store queue. Younger
+ *      loads to the same word that have not executed yet note how long the store held them back.
+ * Inputs:
+ * 	slot: its load/store queue slot
+ * 	current_cycle: the cycle it leaves in
+ * Returns:
+ * 	None
+ */
+TOM_STAGE void lsq_remove(tom_machine_t *m, const tom_config_t *cfg, int slot, int current_cycle) {
+    rs_t *rs = &m->reserv[RS_INT];
+    lsq_entry_t *store = &m->lsq[slot];
+    int i;
+
+    if(store->store) {
+        for(i = (slot - m->lsq_head + cfg->lsq_size) % cfg->lsq_size + 1; i < m->lsq_size; i++) {
+            lsq_entry_t *load = &m->lsq[LSQ_slot(m, cfg, i)];
+            if(load->entry == -1 || load->store || rs->timing[load->entry].execute != 0) continue;
+            if(LSQ_WORD(load->addr) != LSQ_WORD(store->addr)) continue;
 
-instruction_t *pop_from_IFQ() {
-    instruction_t *instr = instr_queue[0];
-    int i = 1;
-    
-    for(; i < INSTR_QUEUE_SIZE; i++) {
-        instr_queue[i-1] = instr_queue[i];
-        instr_queue[i] = NULL;
+            //an exact match could forward once the store had its data; a partial one had to wait for it to leave
+            int until = load->addr == store->addr ? rs->done[store->entry] : current_cycle + 1;
+            if(until > load->wait_until) load->wait_until = until;
+        }
+    }
+
+    store->done = rs->done[store->entry];
+    store->entry = -1;
+    while(m->lsq_size != 0 && m->lsq[m->lsq_head].entry == -1) {
+        m->lsq_head = LSQ_slot(m, cfg, 1);
+        m->lsq_size--;
     }
-    
-    return instr;
 }
 
-int push_to_resource(instruction_t** queue, int size, instruction_t* instr) {
-    int i = 0;
-    for(; i < size; i++) {
-        if(queue[i] == NULL) {
-            queue[i] = instr;
+/*
+ * Description:
+ * 	Checks a load against the older stores in the load/store queue. Addresses come from the
+ *      trace, so a load only waits for the stores that really touch its word (perfect disambiguation).
+ * Inputs:
+ * 	slot: the load's load/store queue slot
+ * 	current_cycle: the cycle it would execute in
+ * 	source_done: set to the cycle the forwarding store had its data, for LSQ_FORWARD
+ * Returns:
+ * 	An enum lsq_status
+ */
+TOM_STAGE int lsq_check(tom_machine_t *m, const tom_config_t *cfg, int slot, int current_cycle, int *source_done) {
+    rs_t *rs = &m->reserv[RS_INT];
+    const lsq_entry_t *load = &m->lsq[slot];
+    int status = LSQ_CLEAR;
+    int i;
+
+    //youngest older store first: the closest store to the word decides
+    for(i = (slot - m->lsq_head + cfg->lsq_size) % cfg->lsq_size - 1; i >= 0; i--) {
+        const lsq_entry_t *store = &m->lsq[LSQ_slot(m, cfg, i)];
+        if(!store->store) continue;
+
+        bool left = store->entry == -1;
+        bool has_data = left || (rs->timing[store->entry].execute != 0 && rs->done[store->entry] <= current_cycle);
+        if(LSQ_WORD(load->addr) == LSQ_WORD(store->addr)) {
+            if(load->addr == store->addr && has_data) {
+                *source_done = left ? store->done : rs->done[store->entry];
+                return LSQ_FORWARD;
+            }
+            if(left) continue; //part of the word, already written to memory
+            return LSQ_BLOCKED;
+        }
+        if(!has_data) status = LSQ_BYPASS;
+    }
+    return status;
+}
+
+//true unless the entry holds a load the load/store queue holds back
+TOM_STAGE bool rs_can_execute(tom_machine_t *m, const tom_config_t *cfg, int cls, int e, int current_cycle) {
+    int slot = m->reserv[cls].lsq[e];
+    int source_done;
+
+    if(cls != RS_INT || !cfg->lsq_size || slot == -1 || m->lsq[slot].store) return true;
+    return lsq_check(m, cfg, slot, current_cycle, &source_done) != LSQ_BLOCKED;
+}
+
+//frees a reservation station entry once its result has been broadcast
+TOM_STAGE void rs_remove(tom_machine_t *m, const tom_config_t *cfg, int cls, int e, int current_cycle) {
+    rs_t *rs = &m->reserv[cls];
+    int c;
+
+    if(cls == RS_INT && cfg->lsq_size && rs->lsq[e] != -1) lsq_remove(m, cfg, rs->lsq[e], current_cycle);
+
+    rs->count--;
+    if(rs->oldest == e) rs->oldest = -1;
+    mask_clear(rs->valid, e);
+    mask_clear(rs->ready, e);
+    mask_clear(rs->in_pool[rs->pool[e]], e);
+    for(c = 0; c < NUM_RS_CLASSES; c++) {
+        memset(rs->wakeup[e][c], 0, sizeof(rs->wakeup[e][c]));
+    }
+}
+
+//the oldest entry of a mask: the one no other entry of the mask is older than; -1 if it is empty
+TOM_STAGE int rs_oldest(const rs_t *rs, const uint64_t *candidates, int words) {
+    int i;
+    int w;
+
+    FOR_EACH_BIT(i, candidates, words) {
+        bool oldest = true;
+        for(w = 0; w < words; w++) {
+            if(rs->older[i][w] & candidates[w]) {
+                oldest = false;
+                break;
+            }
+        }
+        if(oldest) return i;
+    }
+
+    return -1;
+}
+
+/* 
+ * Description: 
+ * 	Picks the oldest instruction that is ready to execute on a functional unit pool,
+ *      ignoring the ones that were issued this cycle and the loads the load/store queue
+ *      holds back, and takes it out of the ready set
+ * Inputs:
+ * 	pool: functional unit pool (its reservation station class is the one searched)
+ * 	current_cycle: the cycle we are at
+ * Returns:
+ * 	The entry of the selected instruction, -1 if none is ready
+ */
+TOM_STAGE int rs_select_oldest_ready(tom_machine_t *m, const tom_config_t *cfg, int pool, int current_cycle) {
+    int cls = fu_pool_class[pool];
+    rs_t *rs = &m->reserv[cls];
+    int words = rs_words(cfg, cls);
+    uint64_t candidates[RS_MASK_WORDS];
+    int i;
+    int w;
+
+    for(w = 0; w < words; w++) {
+        candidates[w] = rs->ready[w] & ~rs->fresh[w] & rs->in_pool[pool][w];
+    }
+
+    while((i = rs_oldest(rs, candidates, words)) != -1) {
+        if(rs_can_execute(m, cfg, cls, i, current_cycle)) {
+            mask_clear(rs->ready, i);
             return i;
         }
+        mask_clear(candidates, i);
     }
-    
+
     return -1;
 }
 
-void update_map_table(instruction_t *instr) {
+//true if an instruction of the pool could start executing in the cycle, given a free unit
+TOM_STAGE bool rs_any_executable(tom_machine_t *m, const tom_config_t *cfg, int pool, int cycle) {
+    int cls = fu_pool_class[pool];
+    rs_t *rs = &m->reserv[cls];
+    int words = rs_words(cfg, cls);
+    uint64_t candidates[RS_MASK_WORDS];
+    int i;
+    int w;
+
+    if(cls != RS_INT || !cfg->lsq_size) return mask_any_both(rs->ready, rs->in_pool[pool], words);
+
+    for(w = 0; w < words; w++) {
+        candidates[w] = rs->ready[w] & rs->in_pool[pool][w];
+    }
+    FOR_EACH_BIT(i, candidates, words) {
+        if(rs_can_execute(m, cfg, cls, i, cycle)) return true;
+    }
+    return false;
+}
+
+//marks the instruction in an entry as issued; it becomes ready once its operands arrive
+TOM_STAGE void rs_issue(tom_machine_t *m, int cls, int e, int current_cycle) {
+    rs_t *rs = &m->reserv[cls];
+
+    rs->timing[e].issue = current_cycle;
+    mask_clear(rs->unissued, e);
+    mask_set(rs->fresh, e);
+    if(rs->pending[e] == 0) {
+        mask_set(rs->ready, e);
+        rs->ready_cycle[e] = current_cycle + 1;
+    }
+}
+
+//starts executing the instruction in an entry on a unit of its pool
+TOM_STAGE void rs_execute(tom_machine_t *m, const tom_config_t *cfg, int cls, int e, int unit, int current_cycle) {
+    rs_t *rs = &m->reserv[cls];
+    int pool = rs->pool[e];
+
+    rs->timing[e].execute = current_cycle;
+    rs->done[e] = current_cycle + rs->latency[e];
+    m->stats.execute_stalls[EXECUTE_OPERANDS] += rs->ready_cycle[e] - (rs->timing[e].issue + 1);
+    m->stats.execute_stalls[EXECUTE_FU_BUSY] += current_cycle - rs->ready_cycle[e];
+    rs->unit[e] = unit;
+    mask_set(rs->executing, e);
+
+    //a load may take its data from an older store instead of memory
+    int slot = rs->lsq[e];
+    bool forwarded = false;
+    if(cls == RS_INT && cfg->lsq_size && slot != -1 && !m->lsq[slot].store) {
+        int source_done = 0;
+        int status = lsq_check(m, cfg, slot, current_cycle, &source_done);
+        int wait_until = m->lsq[slot].wait_until;
+
+        if(status == LSQ_FORWARD) {
+            rs->done[e] = current_cycle + cfg->lsq_fwd_latency;
+            if(source_done > wait_until) wait_until = source_done;
+            forwarded = true;
+            m->stats.loads_forwarded++;
+        }
+        else if(status == LSQ_BYPASS) m->stats.loads_bypassed++;
+        if(wait_until > rs->ready_cycle[e]) m->stats.loads_stalled++;
+    }
+
+    //with caches, the other memory operations access them; a load takes as long as its access
+    if(cls == RS_INT && m->dcache && !forwarded) {
+        int flags = get_instr_hot(m->trace, rs->index[e])->flags;
+        if(flags & INSTR_LOAD)
+            rs->done[e] = tom_cache_load(m->dcache, rs->addr[e], current_cycle, &m->stats.cache);
+        else if(flags & INSTR_STORE)
+            tom_cache_store(m->dcache, rs->addr[e], current_cycle, &m->stats.cache);
+    }
+
+    //a pipelined unit takes the next instruction after its initiation interval;
+    //an unpipelined one only once this instruction has left it for the CDB
+    m->fu_next[pool][unit] = cfg->fu[pool].interval ? current_cycle + cfg->fu[pool].interval : INT_MAX;
+}
+
+//delivers a broadcast result to every entry of one class waiting on the tag
+TOM_STAGE void rs_wakeup(tom_machine_t *m, const tom_config_t *cfg, int cls, int tag, int current_cycle) {
+    rs_t *rs = &m->reserv[cls];
+    uint64_t *consumers = m->reserv[TAG_CLASS(tag)].wakeup[TAG_ENTRY(tag)][cls];
+    int e;
+
+    FOR_EACH_BIT(e, consumers, rs_words(cfg, cls)) {
+        if(--rs->pending[e] == 0 && rs->timing[e].issue != 0) {
+            mask_set(rs->ready, e);
+            rs->ready_cycle[e] = current_cycle + 1;
+        }
+    }
+}
+
+TOM_STAGE void update_map_table(tom_machine_t *m, const int8_t *r_outs, int tag) {
     int i = 0;
     for(; i < NUM_OUTPUT_REGS; i++) {
-        int r_out = instr->r_out[i];
+        int r_out = r_outs[i];
         if(r_out != -1 && r_out != 0) {
             //checking for valid output reg
-            map_table[r_out] = instr;
+            m->map_table[r_out] = tag;
         }
     }
 }
 
-void clear_map_table(instruction_t *instr) {
+TOM_STAGE void clear_map_table(tom_machine_t *m, const int8_t *r_outs, int tag) {
     int i = 0;
     for(; i < NUM_OUTPUT_REGS; i++) {
-        int r_out = instr->r_out[i];
-        if(r_out != -1 && r_out != 0 && map_table[r_out] == instr) {
+        int r_out = r_outs[i];
+        if(r_out != -1 && r_out != 0 && m->map_table[r_out] == tag) {
             //if this intruction was the last to rename r_out
-            map_table[r_out] = NULL;
+            m->map_table[r_out] = -1;
         }
     }
 }
 
-int instr_is_ready(instruction_t *instr) {
-    int i = 0;
-    int is_ready = 1;
-    for(; i < NUM_INPUT_REGS; i++) {
-        if(instr->Q[i] != NULL) is_ready = 0;
-        //i think we'll set instr->Q[i] to NULL once CBD broadcasts?
-        
+//an instruction has left the machine; hands its final stage cycles to whoever wants them
+TOM_STAGE void retire_timing(tom_machine_t *m, int index, const tom_timing_t *timing) {
+    if(m->writeback) {
+        //the only fields of the trace a machine writes to
+        instruction_t *out = get_instr(m->trace, index);
+        out->tom_dispatch_cycle = timing->dispatch;
+        out->tom_issue_cycle = timing->issue;
+        out->tom_execute_cycle = timing->execute;
+        out->tom_cdb_cycle = timing->cdb;
+        out->tom_commit_cycle = timing->commit;
     }
-    
-    return is_ready;
+    if(m->timing_log) m->timing_log[index - m->log_first] = *timing;
+    if(m->streaming) m->retired[index & (m->retired_size - 1)] = 1;
+}
+
+/* BRANCHES */
+
+//predicts a branch as fetch takes it; returns false if it was mispredicted
+TOM_STAGE bool predict_branch(tom_machine_t *m, int index, const instr_hot_t *hot) {
+    //without a target buffer model, unconditional transfers always go the right way
+    if(!(hot->flags & INSTR_COND)) return true;
+
+    m->stats.cond_branches++;
+    if(tom_bpred_update(m->bpred, get_instr(m->trace, index)->pc, (hot->flags & INSTR_TAKEN) != 0)) return true;
+    m->stats.mispredicts++;
+    return false;
 }
 
+//a mispredicted branch resolves in the cycle; fetch restarts bpred_penalty cycles later
+TOM_STAGE void branch_resolve(tom_machine_t *m, const tom_config_t *cfg, int resolve_cycle) {
+    m->fetch_resume = resolve_cycle + cfg->bpred_penalty;
+    if(m->mispredict_rob != -1) m->rob[m->mispredict_rob].ready = resolve_cycle + 1;
+}
 
-instruction_t *get_oldest_ready_int_instr() {
+//a dispatched mispredicted branch waits for the producers of its operands, if any are in flight
+TOM_STAGE void branch_dispatch(tom_machine_t *m, const tom_config_t *cfg, const instr_hot_t *hot, int rob_slot, int current_cycle) {
     int i;
-    int j;
-    instruction_t *oldest_instr = NULL;
-    
-    for(i = 0; i < RESERV_INT_SIZE; i++) {
-        instruction_t *instr = reservINT[i];
-        int in_FU = false;
-        for(j = 0; j < FU_INT_SIZE; j++){
-            if(fuINT[j] = instr) in_FU = true;
-        }
-        if(instr != NULL && !in_FU && instr_is_ready(instr)) {
-            if(oldest_instr == NULL) oldest_instr = instr; //if the first instr in the reservation station is NULL
-            else if(instr->index < oldest_instr->index) oldest_instr = instr;
+    int k;
+
+    m->mispredict_index = -1;
+    m->mispredict_rob = rob_slot;
+    m->branch_waiting = 0;
+    for(i = 0; i < NUM_INPUT_REGS; i++) {
+        int tag = hot->r_in[i] != -1 ? m->map_table[hot->r_in[i]] : -1;
+        if(tag == -1) continue;
+        for(k = 0; k < m->branch_waiting && m->branch_wait[k] != tag; k++);
+        if(k == m->branch_waiting) m->branch_wait[m->branch_waiting++] = tag;
+    }
+    if(m->branch_waiting == 0) branch_resolve(m, cfg, current_cycle + 1);
+}
+
+//a broadcast result may be the last operand the mispredicted branch waits for
+TOM_STAGE void branch_wakeup(tom_machine_t *m, const tom_config_t *cfg, int tag, int current_cycle) {
+    int k;
+    for(k = 0; k < m->branch_waiting; k++) {
+        if(m->branch_wait[k] == tag) {
+            m->branch_wait[k] = m->branch_wait[--m->branch_waiting];
+            if(m->branch_waiting == 0) branch_resolve(m, cfg, current_cycle + 1);
+            return;
         }
     }
+}
 
-    return oldest_instr;
+/* OCCUPANCY SAMPLING */
+
+//the structures the occupancy sampler follows in a configuration: their names, descriptions
+//and sizes. Returns how many there are; occupancy_values lists them in the same order
+static int occupancy_columns(const tom_config_t *cfg, char names[][16], char descs[][64], int *capacity) {
+  int n = 0;
+  int p;
+
+#define OCC_COLUMN(NAME, DESC, CAPACITY) \
+  (snprintf(names[n], 16, "%s", NAME), snprintf(descs[n], 64, "%s", DESC), capacity[n++] = (CAPACITY))
+  OCC_COLUMN("ifq", "instruction queue entries", cfg->ifq_size);
+  OCC_COLUMN("rs_int", "INT reservation station entries", cfg->rs_int_size);
+  OCC_COLUMN("rs_fp", "FP reservation station entries", cfg->rs_fp_size);
+  if (cfg->lsq_size)
+    OCC_COLUMN("lsq", "load/store queue entries", cfg->lsq_size);
+  if (cfg->rob_size)
+    OCC_COLUMN("rob", "reorder buffer entries", cfg->rob_size);
+  if (cfg->prf_size)
+    OCC_COLUMN("prf", "physical registers", cfg->prf_size);
+  for (p = 0; p < NUM_FU_POOLS; p++) {
+    if (cfg->fu[p].count == 0)
+      continue;
+    snprintf(names[n], 16, "fu_%s", fu_pools[p].name);
+    snprintf(descs[n], 64, "instructions on the %s units", fu_pools[p].name);
+    capacity[n++] = fu_pool_class[p] == RS_INT ? cfg->rs_int_size : cfg->rs_fp_size;
+  }
+  OCC_COLUMN("cdb", "common data buses", cfg->num_cdb);
+#undef OCC_COLUMN
+  return n;
 }
 
-//only called when there is space available in FP_FU
-instruction_t *get_oldest_ready_fp_instr() {
-    int i;
-    int j;
-    instruction_t *oldest_instr = NULL;
-    
-    for(i = 0; i < RESERV_FP_SIZE; i++) {
-        instruction_t *instr = reservFP[i];
-        
-        int in_FU = false;
-        for(j = 0; j < FU_FP_SIZE; j++){
-            if(fuFP[j] = instr) in_FU = true;
+//the number of entries in use of every structure occupancy_columns lists
+static void occupancy_values(tom_machine_t *m, const tom_config_t *cfg, int *values) {
+  int n = 0;
+  int p;
+  int w;
+
+  values[n++] = m->instr_queue_size;
+  values[n++] = m->reserv[RS_INT].count;
+  values[n++] = m->reserv[RS_FP].count;
+  if (cfg->lsq_size)
+    values[n++] = m->lsq_size;
+  if (cfg->rob_size)
+    values[n++] = m->rob_count;
+  if (cfg->prf_size)
+    values[n++] = cfg->prf_size - m->prf_free;
+  for (p = 0; p < NUM_FU_POOLS; p++) {
+    if (cfg->fu[p].count == 0)
+      continue;
+    //instructions occupy their unit from execute until they get a CDB
+    values[n] = 0;
+    for (w = 0; w < rs_words(cfg, fu_pool_class[p]); w++)
+      values[n] += __builtin_popcountll(m->reserv[fu_pool_class[p]].in_pool[p][w]
+                                      & m->reserv[fu_pool_class[p]].executing[w]);
+    n++;
+  }
+  values[n++] = m->commonDataBus_count;
+}
+
+//the machine holds its current occupancy for the cycles; kept out of line so that the cycle
+//code only pays for a test of m->occupancy when sampling is off
+static __attribute__((noinline)) void sample_occupancy(tom_machine_t *m, const tom_config_t *cfg, int cycles) {
+  int values[TOM_OCC_MAX_COLUMNS];
+  occupancy_values(m, cfg, values);
+  tom_occupancy_add(m->occupancy, values, cycles, m->fetch_count);
+}
+
+//gives the machine an occupancy sampler if the options ask for one; it starts with cycle 0,
+//in which the machine is empty
+static void attach_occupancy(tom_machine_t *m) {
+  char names[TOM_OCC_MAX_COLUMNS][16];
+  char descs[TOM_OCC_MAX_COLUMNS][64];
+  int capacity[TOM_OCC_MAX_COLUMNS];
+  const char *name_ptrs[TOM_OCC_MAX_COLUMNS];
+  int i;
+
+  if (!tom_occupancy && !occ_out_path)
+    return;
+  int columns = occupancy_columns(m->cfg, names, descs, capacity);
+  for (i = 0; i < columns; i++)
+    name_ptrs[i] = names[i];
+  m->occupancy = tom_occupancy_create(columns, name_ptrs, capacity, occ_out_path, occ_binary,
+                                      occ_interval);
+  sample_occupancy(m, m->cfg, 1);
+}
+
+/* STALL ACCOUNTING */
+
+//why fetch cannot take an instruction in the cycle, -1 if it can (or has nothing left to fetch)
+TOM_STAGE int fetch_stall_cause(tom_machine_t *m, const tom_config_t *cfg, int cycle) {
+    if(cycle < m->fetch_resume) return FETCH_REDIRECT;
+    if(m->instr_queue_size == cfg->ifq_size) return FETCH_IFQ_FULL;
+    return -1;
+}
+
+//why the instruction at the head of the IFQ cannot be dispatched (checked in dispatch's order)
+TOM_STAGE int dispatch_stall_cause(tom_machine_t *m, const tom_config_t *cfg) {
+    int head = peek_IFQ(m);
+    if(head == -1) return DISPATCH_IFQ_EMPTY;
+
+    const instr_hot_t *hot = get_instr_hot(m->trace, head);
+    if(hot->cls != INSTR_CLASS_BRANCH) {
+        if(lsq_full(m, cfg, hot)) return DISPATCH_LSQ_FULL;
+        if(!rob_full(m, cfg)) {
+            if(prf_short(m, cfg, hot)) return DISPATCH_PRF_EMPTY;
+            return rs_class_of(hot) == RS_INT ? DISPATCH_RS_INT_FULL : DISPATCH_RS_FP_FULL;
         }
-        
-        if(instr != NULL && instr_is_ready(instr)) {
-            if(oldest_instr == NULL) oldest_instr = instr; //if the first instr in the reservation station is NULL
-            else if(instr->index < oldest_instr->index) oldest_instr = instr;
+    }
+    return DISPATCH_ROB_FULL;
+}
+
+//the oldest occupied entry of a reservation station, -1 if it is empty
+TOM_STAGE int rs_oldest_entry(tom_machine_t *m, const tom_config_t *cfg, int cls) {
+    rs_t *rs = &m->reserv[cls];
+    if(rs->oldest == -1) rs->oldest = rs_oldest(rs, rs->valid, rs_words(cfg, cls));
+    return rs->oldest;
+}
+
+//what the instruction in a reservation station entry is doing in the cycle
+TOM_STAGE int entry_cpi_component(tom_machine_t *m, const tom_config_t *cfg, int cls, int e, int cycle) {
+    const rs_t *rs = &m->reserv[cls];
+
+    if(mask_test(rs->executing, e)) return rs->done[e] > cycle ? CPI_EXECUTE : CPI_CDB;
+    if(mask_test(rs->ready, e) && rs_can_execute(m, cfg, cls, e, cycle)) return CPI_FU_BUSY;
+    return CPI_OPERANDS;
+}
+
+//the component of the CPI stack a cycle in which dispatch stalled for the cause goes to
+TOM_STAGE int cpi_stall_component(tom_machine_t *m, const tom_config_t *cfg, int stall, int cycle) {
+    int c;
+    int e;
+
+    switch(stall) {
+    case DISPATCH_IFQ_EMPTY:
+        if(cycle < m->fetch_resume) return CPI_BRANCH;
+        return m->fetch_index > m->num_insn ? CPI_DRAIN : CPI_FRONTEND;
+    case DISPATCH_RS_INT_FULL:
+    case DISPATCH_RS_FP_FULL:
+        c = stall == DISPATCH_RS_INT_FULL ? RS_INT : RS_FP;
+        return entry_cpi_component(m, cfg, c, rs_oldest_entry(m, cfg, c), cycle);
+    case DISPATCH_LSQ_FULL:
+        return entry_cpi_component(m, cfg, RS_INT, m->lsq[m->lsq_head].entry, cycle);
+    default:
+        //the head of the ROB has completed, or it is the oldest instruction in the stations
+        //(physical registers are freed by commit, or by the CDB without a ROB)
+        if(cfg->rob_size && m->rob[m->rob_head].ready != INT_MAX) return CPI_COMMIT;
+        int oldest_cls = -1;
+        int oldest_e = -1;
+        for(c = 0; c < NUM_RS_CLASSES; c++) {
+            e = rs_oldest_entry(m, cfg, c);
+            if(e != -1 && (oldest_cls == -1 || m->reserv[c].index[e] < m->reserv[oldest_cls].index[oldest_e])) {
+                oldest_cls = c;
+                oldest_e = e;
+            }
         }
+        return oldest_cls == -1 ? CPI_COMMIT : entry_cpi_component(m, cfg, oldest_cls, oldest_e, cycle);
     }
+}
+
+//a stalled dispatch counts against its cause and the CPI stack
+TOM_STAGE void count_dispatch_stall(tom_machine_t *m, const tom_config_t *cfg, int cycle, int cycles) {
+    int stall = dispatch_stall_cause(m, cfg);
+    m->stats.dispatch_stalls[stall] += cycles;
+    m->stats.cpi[cpi_stall_component(m, cfg, stall, cycle)] += cycles;
+}
+
+/*
+ * Description:
+ * 	Accounts for cycles the simulation skipped. Nothing changed in them, so fetch and
+ *      dispatch stalled for the reason they would give in the first of them, given the state
+ *      the last simulated cycle left. (The later stages count their stalls per instruction.)
+ * Inputs:
+ * 	first: the first skipped cycle
+ * 	cycles: the number of skipped cycles
+ * Returns:
+ * 	None
+ */
+TOM_STAGE void count_skipped_cycles(tom_machine_t *m, const tom_config_t *cfg, int first, int cycles) {
+    int stall = fetch_stall_cause(m, cfg, first);
+    if(stall != -1) m->stats.fetch_stalls[stall] += cycles;
+
+    count_dispatch_stall(m, cfg, first, cycles);
 
-    return oldest_instr;
+    //no bus carries a value in a skipped cycle; the last cycle already cleared them
+    if(m->occupancy) sample_occupancy(m, cfg, cycles);
 }
 
 /* 
@@ -233,7 +1302,7 @@ instruction_t *get_oldest_ready_fp_instr() {
  * Returns:
  * 	True: if simulation is finished
  */
-static bool is_simulation_done(counter_t sim_insn) {
+static bool is_simulation_done(tom_machine_t *m, counter_t sim_insn) {
 
   /* ECE552: YOUR CODE GOES HERE */
 //    int rtn = 0;
@@ -241,20 +1310,16 @@ static bool is_simulation_done(counter_t sim_insn) {
 //    rtn = false;
 //    commonDataBus = NULL;
 //    return rtn;
-    if(commonDataBus != NULL) return false;
+    if(m->commonDataBus_count != 0) return false;
+    if(m->fetch_index <= sim_insn) return false;
     
-    int i;
-    for(i = 0; i < RESERV_INT_SIZE; i++) {
-        if(reservINT[i] != NULL) return false;
-    }
-
-    for(i = 0; i < RESERV_FP_SIZE; i++) {
-        if(reservFP[i] != NULL) return false;
+    int c;
+    for(c = 0; c < NUM_RS_CLASSES; c++) {
+        if(m->reserv[c].count != 0) return false;
     }
     
-    for(i = 0; i < INSTR_QUEUE_SIZE; i++) {
-        if(instr_queue[i] != NULL) return false;
-    }
+    if(m->instr_queue_size != 0) return false;
+    if(m->rob_count != 0) return false;
     
     return true;
     
@@ -263,115 +1328,94 @@ static bool is_simulation_done(counter_t sim_insn) {
 
 /* 
  * Description: 
- * 	Retires the instruction from writing to the Common Data Bus
+ * 	Retires the instructions from writing to the Common Data Buses
  * Inputs:
  * 	current_cycle: the cycle we are at
  * Returns:
  * 	None
  */
-void CDB_To_retire(int current_cycle) {
+TOM_STAGE void CDB_To_retire(tom_machine_t *m, const tom_config_t *cfg, int current_cycle) {
 
   /* ECE552: YOUR CODE GOES HERE */
-    if (commonDataBus == NULL) return;
-
-    int i;
-    int j;
-    //For all instrs in res station, reset their Q if it is in CDB
-    for(i = 0; i < RESERV_INT_SIZE; i++) {
-        instruction_t *instr = reservINT[i];
-        if (instr == NULL) continue;
-        for (j = 0; j < NUM_INPUT_REGS; j++) {
-            if (instr->Q[j] == commonDataBus) {
-                instr->Q[j] = NULL;
-                commonDataBus = NULL;
-            }
+    int bus;
+    for(bus = 0; bus < m->commonDataBus_count; bus++) {
+        int tag = m->commonDataBus_tag[bus];
+
+        //wake up the reservation station entries that wait on the broadcast tag
+        int c;
+        for(c = 0; c < NUM_RS_CLASSES; c++) {
+            rs_wakeup(m, cfg, c, tag, current_cycle);
         }
-    }
 
-    //For all instrs in res station, reset their Q if it is in CDB
-    for(i = 0; i < RESERV_FP_SIZE; i++) {
-        instruction_t *instr = reservFP[i];
-        if (instr == NULL) continue;
-        for (j = 0; j < NUM_INPUT_REGS; j++) {
-            if (instr->Q[j] == commonDataBus) {
-                instr->Q[j] = NULL;
-                commonDataBus = NULL;
-            }
+        if(m->branch_waiting) branch_wakeup(m, cfg, tag, current_cycle);
+
+        //later instructions read the register file instead of waiting on the broadcast
+        int cls = TAG_CLASS(tag);
+        int e = TAG_ENTRY(tag);
+        clear_map_table(m, m->reserv[cls].r_out[e], tag);
+        if(cfg->rob_size) {
+            //complete: it commits from the reorder buffer from the next cycle on
+            rob_entry_t *entry = &m->rob[m->reserv[cls].rob[e]];
+            entry->timing = m->reserv[cls].timing[e];
+            entry->ready = current_cycle + 1;
+        }
+        else {
+            retire_timing(m, m->commonDataBus[bus], &m->reserv[cls].timing[e]);
+            if(cfg->prf_size) m->prf_free += prf_dests(m->reserv[cls].r_out[e]);
         }
+        rs_remove(m, cfg, cls, e, current_cycle);
     }
+
+    //the buses only carry a value for the cycle they were granted in
+    m->commonDataBus_count = 0;
 }
 
 
 /* 
  * Description: 
- * 	Moves an instruction from the execution stage to common data bus (if possible)
+ * 	Moves instructions from the execution stage to the common data buses (if possible).
+ *      The buses go to the oldest finished instructions first.
  * Inputs:
  * 	current_cycle: the cycle we are at
  * Returns:
  * 	None
  */
-void execute_To_CDB(int current_cycle) {
+TOM_STAGE void execute_To_CDB(tom_machine_t *m, const tom_config_t *cfg, int current_cycle) {
 
   /* ECE552: YOUR CODE GOES HERE */
-    int i;
-    int cdbINT = 0;
-    int cdb_index = -1;
-    for(i = 0; i < FU_INT_SIZE; i++) {
-        if(fuINT[i] != NULL) {
-            instruction_t *instr = fuINT[i];
-            if (current_cycle - instr->tom_execute_cycle >= FU_FP_LATENCY) { // Ready to broadcast
-                if (commonDataBus == NULL){
-                     commonDataBus = instr;
-                     cdbINT = true;
-                     cdb_index = i;
-                }
-                else if (instr->index < commonDataBus->index){
-                    commonDataBus = instr;
-                    cdbINT = true;
-                    cdb_index = i;
+    int bus;
+    for(bus = 0; bus < cfg->num_cdb; bus++) {
+        int c;
+        int e;
+        int oldest = -1;
+        int oldest_cls = 0;
+        int oldest_e = -1;
+        for(c = 0; c < NUM_RS_CLASSES; c++) {
+            rs_t *rs = &m->reserv[c];
+            FOR_EACH_BIT(e, rs->executing, rs_words(cfg, c)) {
+                if(rs->done[e] <= current_cycle) { // Ready to broadcast
+                    if(oldest == -1 || rs->index[e] < oldest) {
+                        oldest = rs->index[e];
+                        oldest_cls = c;
+                        oldest_e = e;
+                    }
                 }
             }
         }
-    }
 
-    for(i = 0; i < FU_FP_SIZE; i++) {
-        if(fuFP[i] != NULL) {
-            instruction_t *instr = fuFP[i];
-            if (current_cycle - instr->tom_execute_cycle >= FU_FP_LATENCY) { // Ready to broadcast
-                if (commonDataBus == NULL){
-                     commonDataBus = instr;
-                     cdbINT = false;
-                     cdb_index = i;
-                }
-                else if (instr->index < commonDataBus->index){
-                     commonDataBus = instr;
-                     cdbINT = false;
-                     cdb_index = i;
-                }
-            }
-        }
-    }
+        if (oldest == -1) break; //no other instruction is done
 
-    if (commonDataBus != NULL) {
-        commonDataBus->tom_cdb_cycle = current_cycle; //Only the last set instr (oldest) gets to use the CDB
-        if (cdbINT) {
-            fuINT[cdb_index] = NULL;
-            for(i = 0; i < RESERV_INT_SIZE; i++) {
-                if(reservINT[i] == commonDataBus) {
-                    reservINT[i] = NULL;
-                    break;
-                }
-            }
-        }
-            else {
-                fuFP[cdb_index] = NULL;
-                for(i = 0; i < RESERV_FP_SIZE; i++) {
-                    if(reservFP[i] == commonDataBus) {
-                        reservFP[i] = NULL;
-                        break;
-                    }
-                }
-            }
+        //the reservation station entry is freed once the broadcast has been retired
+        rs_t *rs = &m->reserv[oldest_cls];
+        int pool = rs->pool[oldest_e];
+        mask_clear(rs->executing, oldest_e);
+        if(!cfg->fu[pool].interval) m->fu_next[pool][rs->unit[oldest_e]] = current_cycle + 1;
+
+        m->commonDataBus[bus] = oldest;
+        m->commonDataBus_tag[bus] = RS_TAG(oldest_cls, oldest_e);
+        m->commonDataBus_count++;
+        rs->timing[oldest_e].cdb = current_cycle;
+        m->stats.cdb_lost += current_cycle - rs->done[oldest_e];
     }
 }
 
@@ -385,30 +1429,19 @@ void execute_To_CDB(int current_cycle) {
  * Returns:
  * 	None
  */
-void issue_To_execute(int current_cycle) {
+TOM_STAGE void issue_To_execute(tom_machine_t *m, const tom_config_t *cfg, int current_cycle) {
 
   /* ECE552: YOUR CODE GOES HERE */
-    //check if we can send an INT instruction through
-    int i;
-    for(i = 0; i < FU_INT_SIZE; i++) {
-        if(fuINT[i] == NULL) {
-            //can add an instruction
-            instruction_t *instr = get_oldest_ready_int_instr();
-            if(instr != NULL && instr->tom_issue_cycle  < current_cycle) {
-                fuINT[i] = instr;
-                instr->tom_execute_cycle = current_cycle;
-            }
-        }
-    }
-    
-    //check if we can send an FP instruction through
-    for(i = 0; i < FU_FP_SIZE; i++) {
-        if(fuFP[i] == NULL) {
-            //can add an instruction
-            instruction_t *instr = get_oldest_ready_fp_instr();
-            if(instr != NULL && instr->tom_issue_cycle  < current_cycle) {
-                fuFP[i] = instr;
-                instr->tom_execute_cycle = current_cycle;
+    //pools in order, INT before FP; each free unit takes the oldest ready instruction of its pool
+    int p;
+    int u;
+    for(p = 0; p < NUM_FU_POOLS; p++) {
+        for(u = 0; u < cfg->fu[p].count; u++) {
+            if(m->fu_next[p][u] <= current_cycle) {
+                //can add an instruction
+                int e = rs_select_oldest_ready(m, cfg, p, current_cycle);
+                if(e == -1) break;
+                rs_execute(m, cfg, fu_pool_class[p], e, u, current_cycle);
             }
         }
     }
@@ -422,237 +1455,2283 @@ void issue_To_execute(int current_cycle) {
  * Returns:
  * 	None
  */
-void dispatch_To_issue(int current_cycle) {
+TOM_STAGE void dispatch_To_issue(tom_machine_t *m, const tom_config_t *cfg, int current_cycle) {
 
   /* ECE552: YOUR CODE GOES HERE */
-    
-    int i;
-    
-    //since only one instruction enters dispatch in one cycle there should  only be one instruction with an unassigned issue cyle
-    
-    for(i = 0; i < RESERV_INT_SIZE; i++) {
-        instruction_t *instr = reservINT[i];
-        if(instr && instr->tom_issue_cycle == 0 && instr->tom_dispatch_cycle < current_cycle) {
-            instr->tom_issue_cycle = current_cycle;
-        }
-    }
-    
-    //check if we can send an FP instruction through
-    for(i = 0; i < RESERV_FP_SIZE; i++) {
-        instruction_t *instr = reservFP[i];
-        if(instr && instr->tom_issue_cycle == 0 && instr->tom_dispatch_cycle < current_cycle) {
-            instr->tom_issue_cycle = current_cycle;
+    int c;
+    int e;
+
+    //instructions dispatched in an earlier cycle move to issue
+    for(c = 0; c < NUM_RS_CLASSES; c++) {
+        rs_t *rs = &m->reserv[c];
+        memset(rs->fresh, 0, sizeof(rs->fresh));
+        FOR_EACH_BIT(e, rs->unissued, rs_words(cfg, c)) {
+            if(rs->timing[e].dispatch < current_cycle) rs_issue(m, c, e, current_cycle);
         }
     }
 }
 
 /* 
  * Description: 
- * 	Grabs an instruction from the instruction trace (if possible)
+ * 	Grabs up to fetch_width instructions from the instruction trace (if possible).
+ *      Fetch stops after a mispredicted branch, until the branch resolves.
  * Inputs:
- *      trace: instruction trace with all the instructions executed
+ * 	current_cycle: the cycle we are at
  * Returns:
  * 	None
  */
-void fetch(instruction_trace_t* trace) {
+TOM_STAGE void fetch(tom_machine_t *m, const tom_config_t *cfg, int current_cycle) {
 
   /* ECE552: YOUR CODE GOES HERE */
-    instruction_t* instr = get_instr(trace, fetch_index);
-    
-    while(IS_TRAP(instr->op) || instr->op == 0) instr = get_instr(trace, ++fetch_index);
+    int stall = fetch_stall_cause(m, cfg, current_cycle);
+    if(stall != -1) {
+        m->stats.fetch_stalls[stall]++;
+        return;
+    }
+
+    int fetched;
+    for(fetched = 0; fetched < cfg->fetch_width; fetched++) {
+        if(m->fetch_index > m->num_insn) return; //the whole trace has been fetched
+
+        //skipped instructions never enter the machine; the trace links each instruction to the
+        //next one that is not skipped, so this only walks gaps the trace has not linked yet
+        const instr_hot_t *hot = get_instr_hot(m->trace, m->fetch_index);
+        while(hot->cls == INSTR_CLASS_SKIP) {
+            if(++m->fetch_index > m->num_insn) return;
+            hot = get_instr_hot(m->trace, m->fetch_index);
+        }
     
-    int pushed = push_to_IFQ(instr);
-    if(pushed) {
-        fetch_index++;
+        int pushed = push_to_IFQ(m, cfg, m->fetch_index);
+        if(!pushed) return;
+
+        int index = m->fetch_index;
+        m->fetch_index += hot->next ? hot->next : 1;
+        m->fetch_count++;
+
+        if(hot->cls == INSTR_CLASS_BRANCH && cfg->bpred != BPRED_PERFECT && !predict_branch(m, index, hot)) {
+            m->mispredict_index = index;
+            m->fetch_resume = INT_MAX;
+            return;
+        }
     }
 }
 
 /* 
  * Description: 
- * 	Calls fetch and dispatches an instruction at the same cycle (if possible)
+ * 	Dispatches up to dispatch_width instructions from the IFQ, in order (if possible)
  * Inputs:
- *      trace: instruction trace with all the instructions executed
  * 	current_cycle: the cycle we are at
  * Returns:
- * 	None
+ * 	The number of instructions dispatched
  */
-void fetch_To_dispatch(instruction_trace_t* trace, int current_cycle) {
-
-  fetch(trace);
+TOM_STAGE int dispatch(tom_machine_t *m, const tom_config_t *cfg, int current_cycle) {
   
   /* ECE552: YOUR CODE GOES HERE */
-    instruction_t *next_instr = instr_queue[0];
-    
-    if(IS_BRANCH(next_instr->op)) {
-        pop_from_IFQ();
-        next_instr->tom_dispatch_cycle = current_cycle;
-        return;
-    }
+    int dispatched;
+    for(dispatched = 0; dispatched < cfg->dispatch_width; dispatched++) {
+        int next_instr = peek_IFQ(m);
+        if(next_instr == -1) return dispatched;
+        const instr_hot_t *hot = get_instr_hot(m->trace, next_instr);
     
-    if(USES_INT_FU(next_instr->op)) {
-        int i;
-        int rs_idx = -1;
-        for(i = 0; i < RESERV_INT_SIZE; i++) {
-            if(reservINT[i] == NULL) {
-                reservINT[i] = next_instr;
-                rs_idx = i;
-                break;
-            }
-        }
-
-        if(rs_idx != -1) { //There was room for it in RS
-            pop_from_IFQ(); //Remove from from of IFQ
-            
-            //update mapTable and dependencies in RS
-            for(i = 0; i < NUM_INPUT_REGS; i++) {
-                if (next_instr->r_in[i] != -1) next_instr->Q[i] = map_table[next_instr->r_in[i]]; //Set RAW HAZARDS
-                else next_instr->Q[i] = NULL;
+        switch(hot->cls) {
+        case INSTR_CLASS_BRANCH: {
+            if(rob_full(m, cfg)) return dispatched;
+            pop_from_IFQ(m, cfg);
+            tom_timing_t timing = { current_cycle, 0, 0, 0, 0 };
+            int slot = -1;
+            if(cfg->rob_size) {
+                //a correctly predicted branch is taken to be resolved as it is dispatched
+                slot = rob_insert(m, cfg, next_instr);
+                m->rob[slot].timing = timing;
+                if(next_instr != m->mispredict_index) m->rob[slot].ready = current_cycle + 1;
             }
-            update_map_table(next_instr);
-            
-            next_instr->tom_dispatch_cycle = current_cycle;
-            return;
+            else retire_timing(m, next_instr, &timing);
+            if(next_instr == m->mispredict_index) branch_dispatch(m, cfg, hot, slot, current_cycle);
+            break;
         }
-    }
     
-    if(USES_FP_FU(next_instr->op)) {
-        int i;
-        int rs_idx = -1;
-        for(i = 0; i < RESERV_FP_SIZE; i++) {
-            if(reservFP[i] == NULL) {
-                reservFP[i] = next_instr;
-                rs_idx = i;
-                break;
+        case INSTR_CLASS_INT:
+        case INSTR_CLASS_FP: {
+            int cls = rs_class_of(hot);
+            //no room in the LSQ, the ROB or the physical register file either
+            if(lsq_full(m, cfg, hot) || rob_full(m, cfg) || prf_short(m, cfg, hot)) return dispatched;
+            int e = rs_insert(m, cfg, cls, next_instr, hot);
+
+            if(e == -1) return dispatched; //no room in RS; younger instructions wait behind it
+            pop_from_IFQ(m, cfg); //Remove from from of IFQ
+            if(cfg->lsq_size && (hot->flags & (INSTR_LOAD | INSTR_STORE)))
+                m->reserv[cls].lsq[e] = lsq_insert(m, cfg, e, hot);
+            if(cfg->rob_size) m->reserv[cls].rob[e] = rob_insert(m, cfg, next_instr);
+            if(cfg->prf_size) {
+                int regs = prf_dests(hot->r_out);
+                m->prf_free -= regs;
+                if(cfg->rob_size) m->rob[m->reserv[cls].rob[e]].regs = regs;
             }
+            update_map_table(m, hot->r_out, RS_TAG(cls, e));
+            m->reserv[cls].timing[e].dispatch = current_cycle;
+            break;
         }
 
-        if(rs_idx != -1) {
-            pop_from_IFQ();
-            
-            //update mapTable and dependencies in RS
-            for(i = 0; i < NUM_INPUT_REGS; i++) {
-                if (next_instr->r_in[i] != -1) next_instr->Q[i] = map_table[next_instr->r_in[i]]; //Set RAW HAZARDS
-                else next_instr->Q[i] = NULL;
-            }
-            update_map_table(next_instr);
-            
-            next_instr->tom_dispatch_cycle = current_cycle;
-            return;
+        default:
+            return dispatched;
         }
     }
+    return dispatched;
+}
+
+/*
+ * Description:
+ * 	Calls fetch and dispatches up to dispatch_width instructions, in order, at the same cycle (if possible)
+ * Inputs:
+ * 	current_cycle: the cycle we are at
+ * Returns:
+ * 	None
+ */
+TOM_STAGE void fetch_To_dispatch(tom_machine_t *m, const tom_config_t *cfg, int current_cycle) {
+
+  fetch(m, cfg, current_cycle);
+
+  if(dispatch(m, cfg, current_cycle) != 0) m->stats.cpi[CPI_BASE]++;
+  else count_dispatch_stall(m, cfg, current_cycle, 1);
+}
+
+/*
+ * Description:
+ * 	Commits up to dispatch_width completed instructions from the head of the reorder
+ *      buffer, in program order
+ * Inputs:
+ * 	current_cycle: the cycle we are at
+ * Returns:
+ * 	None
+ */
+TOM_STAGE void commit(tom_machine_t *m, const tom_config_t *cfg, int current_cycle) {
+    int committed;
+    for(committed = 0; committed < cfg->dispatch_width && m->rob_count != 0; committed++) {
+        rob_entry_t *head = &m->rob[m->rob_head];
+        if(head->ready > current_cycle) return;
+
+        head->timing.commit = current_cycle;
+        retire_timing(m, head->index, &head->timing);
+        m->prf_free += head->regs;
+        m->rob_head = ROB_slot(m, cfg, 1);
+        m->rob_count--;
+    }
 }
 
-void debug_cycle(int cycle);
+//true if the instruction at the head of the IFQ can leave it this cycle
+TOM_STAGE bool can_dispatch(tom_machine_t *m, const tom_config_t *cfg, const instr_hot_t *hot) {
+    switch(hot->cls) {
+    case INSTR_CLASS_BRANCH:
+        return !rob_full(m, cfg);
+    case INSTR_CLASS_INT:
+    case INSTR_CLASS_FP:
+        return m->reserv[rs_class_of(hot)].count < rs_size(cfg, rs_class_of(hot)) && !lsq_full(m, cfg, hot)
+               && !rob_full(m, cfg) && !prf_short(m, cfg, hot);
+    default:
+        return false;
+    }
+}
 
 /* 
  * Description: 
- * 	Performs a cycle-by-cycle simulation of the 4-stage pipeline
+ * 	Finds the next cycle in which any stage can change the machine state, given that
+ *      all stages have just been run for current_cycle. Every cycle strictly in between
+ *      would leave the machine untouched, so the simulation can jump over them.
  * Inputs:
- *      trace: instruction trace with all the instructions executed
+ * 	current_cycle: the cycle that was just simulated
  * Returns:
- * 	The total number of cycles it takes to execute the instructions.
- * Extra Notes:
- * 	sim_num_insn: the number of instructions in the trace
+ * 	The next cycle worth simulating, or INT_MAX if nothing can ever happen again
  */
-counter_t runTomasulo(instruction_trace_t* trace)
+TOM_STAGE int next_event_cycle(tom_machine_t *m, const tom_config_t *cfg, int current_cycle) {
+    int i;
+    int next = INT_MAX;
+
+    //the front end can fetch (once fetch restarts after a mispredicted branch) or dispatch
+    if(m->fetch_index <= m->num_insn && m->instr_queue_size < cfg->ifq_size) {
+        if(m->fetch_resume <= current_cycle + 1) return current_cycle + 1;
+        if(m->fetch_resume < next) next = m->fetch_resume;
+    }
+    if(m->instr_queue_size != 0 && can_dispatch(m, cfg, get_instr_hot(m->trace, peek_IFQ(m)))) return current_cycle + 1;
+
+    //the head of the reorder buffer can commit
+    if(m->rob_count != 0) {
+        int ready = m->rob[m->rob_head].ready;
+        if(ready <= current_cycle + 1) return current_cycle + 1;
+        if(ready < next) next = ready;
+    }
+
+    //a dispatched instruction still has to be issued
+    int c;
+    for(c = 0; c < NUM_RS_CLASSES; c++) {
+        if(mask_any(m->reserv[c].unissued, rs_words(cfg, c))) return current_cycle + 1;
+    }
+
+    //a ready instruction is waiting on a functional unit of its pool; a pipelined unit
+    //frees up by itself, an unpipelined one when its instruction gets the CDB (below)
+    int p;
+    for(p = 0; p < NUM_FU_POOLS; p++) {
+        if(cfg->fu[p].count == 0 || !rs_any_executable(m, cfg, p, current_cycle + 1)) continue;
+        for(i = 0; i < cfg->fu[p].count; i++) {
+            int idle = MAX(m->fu_next[p][i], current_cycle + 1);
+            if(idle == current_cycle + 1) return current_cycle + 1;
+            if(idle < next) next = idle;
+        }
+    }
+
+    //otherwise only a functional unit finishing can wake the machine up
+    //(the completion test must mirror the one in execute_To_CDB)
+    for(c = 0; c < NUM_RS_CLASSES; c++) {
+        int e;
+        FOR_EACH_BIT(e, m->reserv[c].executing, rs_words(cfg, c)) {
+            if(m->reserv[c].done[e] < next) next = m->reserv[c].done[e];
+        }
+    }
+
+    //a unit that lost the CDB retries in the very next cycle
+    if(next <= current_cycle) return current_cycle + 1;
+
+    return next;
+}
+
+//simulates all the stages for one cycle
+TOM_STAGE void simulate_cycle(tom_machine_t *m, const tom_config_t *cfg, int cycle) {
+      if(cycle > m->cycle + 1) count_skipped_cycles(m, cfg, m->cycle + 1, cycle - m->cycle - 1);
+      m->cycle = cycle;
+
+      commit(m, cfg, cycle);
+      fetch_To_dispatch(m, cfg, cycle);
+      dispatch_To_issue(m, cfg, cycle);
+      issue_To_execute(m, cfg, cycle);
+      execute_To_CDB(m, cfg, cycle);
+      //sampled while the buses still hold this cycle's broadcasts
+      if(m->occupancy) sample_occupancy(m, cfg, 1);
+      CDB_To_retire(m, cfg, cycle);
+}
+
+/* SPECIALIZED MACHINES */
+
+//the per-cycle entry points of a machine configuration
+typedef struct tom_machine_fns
 {
-  //initialize instruction queue
-  int i;
-  for (i = 0; i < INSTR_QUEUE_SIZE; i++) {
-    instr_queue[i] = NULL;
+  const tom_config_t *cfg;
+  void (*simulate_cycle)(tom_machine_t *m, int cycle);
+  int (*next_event_cycle)(tom_machine_t *m, int current_cycle);
+}tom_machine_fns_t;
+
+//one copy of the cycle code per configuration in tomasulo.def, with the sizes as constants
+#define TOM_CONFIG(NAME, IFQ, RS_INT_SIZE, RS_FP_SIZE, FETCH, DISPATCH, CDBS,        \
+                   LSQ, LSQ_FWD, ROB, PRF, BPRED, BPRED_BITS, BPRED_PENALTY, CACHE, ...) \
+  static const tom_config_t tom_config_##NAME =                                      \
+    { IFQ, RS_INT_SIZE, RS_FP_SIZE, FETCH, DISPATCH, CDBS, LSQ, LSQ_FWD,              \
+      ROB, PRF, BPRED, BPRED_BITS, BPRED_PENALTY, { __VA_ARGS__ }, CACHE };           \
+  static void simulate_cycle_##NAME(tom_machine_t *m, int cycle) {                   \
+    simulate_cycle(m, &tom_config_##NAME, cycle);                                    \
+  }                                                                                  \
+  static int next_event_cycle_##NAME(tom_machine_t *m, int current_cycle) {          \
+    return next_event_cycle(m, &tom_config_##NAME, current_cycle);                   \
   }
+#include "tomasulo.def"
+#undef TOM_CONFIG
 
-  //initialize reservation stations
-  for (i = 0; i < RESERV_INT_SIZE; i++) {
-      reservINT[i] = NULL;
-  }
+//any other configuration reads its sizes from the machine's own config
+static void simulate_cycle_generic(tom_machine_t *m, int cycle) {
+  simulate_cycle(m, m->cfg, cycle);
+}
 
-  for(i = 0; i < RESERV_FP_SIZE; i++) {
-      reservFP[i] = NULL;
-  }
+static int next_event_cycle_generic(tom_machine_t *m, int current_cycle) {
+  return next_event_cycle(m, m->cfg, current_cycle);
+}
 
-  //initialize functional units
-  for (i = 0; i < FU_INT_SIZE; i++) {
-    fuINT[i] = NULL;
+static const tom_machine_fns_t tom_specialized[] = {
+#define TOM_CONFIG(NAME, ...) \
+  { &tom_config_##NAME, simulate_cycle_##NAME, next_event_cycle_##NAME },
+#include "tomasulo.def"
+#undef TOM_CONFIG
+};
+
+static const tom_machine_fns_t tom_generic = {
+  NULL, simulate_cycle_generic, next_event_cycle_generic
+};
+
+//picks the specialized cycle code matching the configuration, if there is one
+static const tom_machine_fns_t *select_machine(const tom_config_t *cfg) {
+  int i;
+  for (i = 0; i < (int)(sizeof(tom_specialized) / sizeof(tom_specialized[0])); i++) {
+    if (memcmp(tom_specialized[i].cfg, cfg, sizeof(*cfg)) == 0)
+      return &tom_specialized[i];
   }
+  return &tom_generic;
+}
 
-  for (i = 0; i < FU_FP_SIZE; i++) {
-    fuFP[i] = NULL;
+//rejects configurations the machine structures cannot hold
+static void check_config(const tom_config_t *cfg) {
+  if (cfg->ifq_size < 1 || cfg->ifq_size > INSTR_QUEUE_MAX_SIZE)
+    fatal("instruction queue size must be between 1 and %d", INSTR_QUEUE_MAX_SIZE);
+  if (cfg->rs_int_size < 1 || cfg->rs_int_size > RS_MAX_SIZE
+      || cfg->rs_fp_size < 1 || cfg->rs_fp_size > RS_MAX_SIZE)
+    fatal("reservation station sizes must be between 1 and %d", RS_MAX_SIZE);
+  int p;
+  for (p = 0; p < NUM_FU_POOLS; p++) {
+    const tom_fu_pool_t *fu = &cfg->fu[p];
+    if (fu->count < (fu_pools[p].base == p) || fu->count > FU_MAX_SIZE)
+      fatal("%s functional units must number between %d and %d", fu_pools[p].name,
+            fu_pools[p].base == p, FU_MAX_SIZE);
+    if (fu->latency < 1)
+      fatal("%s functional unit latency must be at least 1 cycle", fu_pools[p].name);
+    if (fu->interval < 0)
+      fatal("%s functional unit interval must be 0 (unpipelined) or more", fu_pools[p].name);
   }
+  if (cfg->fetch_width < 1 || cfg->fetch_width > WIDTH_MAX
+      || cfg->dispatch_width < 1 || cfg->dispatch_width > WIDTH_MAX)
+    fatal("fetch and dispatch widths must be between 1 and %d", WIDTH_MAX);
+  if (cfg->num_cdb < 1 || cfg->num_cdb > CDB_MAX_COUNT)
+    fatal("the number of common data buses must be between 1 and %d", CDB_MAX_COUNT);
+  if (cfg->lsq_size < 0 || cfg->lsq_size > LSQ_MAX_SIZE)
+    fatal("load/store queue size must be between 0 and %d", LSQ_MAX_SIZE);
+  if (cfg->lsq_fwd_latency < 1)
+    fatal("store-to-load forwarding latency must be at least 1 cycle");
+  if (cfg->rob_size < 0 || cfg->rob_size > ROB_MAX_SIZE)
+    fatal("reorder buffer size must be between 0 and %d", ROB_MAX_SIZE);
+  //beyond the architectural registers, there must be room to rename any one instruction
+  if (cfg->prf_size && cfg->prf_size < MD_TOTAL_REGS + NUM_OUTPUT_REGS)
+    fatal("a physical register file needs at least %d registers (0: no limit)",
+          MD_TOTAL_REGS + NUM_OUTPUT_REGS);
+  if (cfg->bpred < 0 || cfg->bpred >= NUM_BPRED_KINDS)
+    fatal("unknown branch predictor");
+  if (cfg->bpred_bits < 1 || cfg->bpred_bits > 24)
+    fatal("branch predictor tables must have between 2^1 and 2^24 entries");
+  if (cfg->bpred_penalty < 0)
+    fatal("branch misprediction penalty cannot be negative");
+
+  const tom_cache_config_t *cache = &cfg->cache;
+  if (cache->l1d_kb < 0 || cache->l2_kb < 0)
+    fatal("cache sizes cannot be negative");
+  if (cache->l1d_kb == 0)
+    return;
+  if (!tom_cache_sets(cache->l1d_kb, cache->l1d_assoc, cache->line_size)
+      || (cache->l2_kb && !tom_cache_sets(cache->l2_kb, cache->l2_assoc, cache->line_size)))
+    fatal("cache sizes must divide into a power of two sets of associativity x line size bytes");
+  if (cache->l1d_latency < 1 || cache->l2_latency < 1 || cache->mem_latency < 1)
+    fatal("cache and memory latencies must be at least 1 cycle");
+  if (cache->mshrs < 1 || cache->mshrs > MSHR_MAX_COUNT)
+    fatal("the number of MSHRs must be between 1 and %d", MSHR_MAX_COUNT);
+}
+
+//a machine without an L1D ignores the other cache parameters; clearing them lets it
+//match the specialized configurations whatever they were set to
+static void normalize_config(tom_config_t *cfg) {
+  if (cfg->cache.l1d_kb == 0)
+    memset(&cfg->cache, 0, sizeof(cfg->cache));
+}
+
+//completes machine_config from the options that are not plain numbers, and checks it
+static void setup_machine_config(void) {
+  machine_config.bpred = tom_bpred_lookup(bpred_option);
+  if (machine_config.bpred == -1)
+    fatal("unknown branch predictor `%s'", bpred_option);
+  check_config(&machine_config);
+  normalize_config(&machine_config);
+  parse_op_latencies();
+  instr_print_commit = machine_config.rob_size > 0;
+  if (occ_out_path && occ_interval < 1)
+    fatal("the occupancy interval must be at least 1 cycle");
+
+  if (!strcmp(table_option, "text")) instr_table_format = INSTR_TABLE_TEXT;
+  else if (!strcmp(table_option, "binary")) instr_table_format = INSTR_TABLE_BINARY;
+  else if (!strcmp(table_option, "none")) instr_table_format = INSTR_TABLE_NONE;
+  else fatal("unknown table format `%s'", table_option);
+  instr_table_first = table_num_insts > 0 ? table_insts[0] : 1;
+  instr_table_last = table_num_insts > 1 ? table_insts[1] : INT_MAX;
+  if (instr_table_first < 1 || instr_table_last < instr_table_first)
+    fatal("-tom:table_insts takes a first and a last instruction index, in order, from 1");
+  if (instr_table_sample < 1)
+    fatal("-tom:table_sample must be at least 1");
+  if (simpoint_interval < 0 || simpoint_max_k < 1 || simpoint_per_cluster < 1 || simpoint_warmup < 0)
+    fatal("-tom:simpoint, -tom:simpoint_k, -tom:simpoint_samples and -tom:simpoint_warmup take "
+          "positive values (the interval and the warmup may be 0)");
+  if (parallel_chunks < 0 || parallel_warmup < 0)
+    fatal("-tom:parallel and -tom:parallel_warmup cannot be negative");
+  if (sweep_threads < 1)
+    fatal("-tom:sweep_threads must be at least 1");
+  if (stream_ring_size < 2 || (stream_ring_size & (stream_ring_size - 1)))
+    fatal("-tom:stream_ring must be a power of two, at least 2");
+
+  //a run does one of these at most; they do not combine
+  int modes = (tom_check_skip != 0) + (tom_check_ref != 0) + (simpoint_restore_path != NULL)
+              + (simpoint_interval > 0) + (parallel_chunks > 0) + (sweep_num_specs > 0);
+  if (modes > 1)
+    fatal("-tom:check_skip, -tom:check_ref, -tom:simpoint_restore, -tom:simpoint, -tom:parallel "
+          "and -tom:sweep cannot be combined");
+  if ((tom_occupancy || occ_out_path) && (simpoint_interval > 0 || simpoint_restore_path || parallel_chunks > 0))
+    fatal("-tom:occupancy and -tom:occ_out need a whole run; sampled and parallel simulation have none");
+}
+
+/* RUNNING A MACHINE */
+
+//creates an empty machine at the start of the trace
+static tom_machine_t *create_machine(const tom_config_t *cfg, instruction_trace_t* trace, counter_t num_insn) {
+  tom_machine_t *m = calloc(1, sizeof(tom_machine_t));
+  if (!m)
+    fatal("out of virtual memory");
+
+  m->cfg = cfg;
+  m->trace = trace;
+  m->num_insn = num_insn;
+
+  //functional units start out free
+  build_op_tables(m, cfg);
+
+  m->bpred = tom_bpred_create(cfg->bpred, cfg->bpred_bits);
+  m->mispredict_index = -1;
+  m->dcache = cfg->cache.l1d_kb ? tom_cache_create(&cfg->cache) : NULL;
+
+  int c;
+  for (c = 0; c < NUM_RS_CLASSES; c++)
+    m->reserv[c].oldest = -1;
 
   //initialize map_table to no producers
   int reg;
   for (reg = 0; reg < MD_TOTAL_REGS; reg++) {
-    map_table[reg] = NULL;
+    m->map_table[reg] = -1;
   }
-  
+
+  //the architectural registers hold a physical register each
+  m->prf_free = cfg->prf_size - MD_TOTAL_REGS;
+
+  m->commonDataBus_count = 0;
+  m->fetch_index = 0;
+
+  //nothing is fetched before cycle 1, but the cycle counts include cycle 0
+  m->stats.cpi[CPI_FRONTEND] = 1;
+  return m;
+}
+
+//frees a machine and everything it owns
+static void destroy_machine(tom_machine_t *m) {
+  tom_bpred_free(m->bpred);
+  tom_cache_free(m->dcache);
+  tom_occupancy_free(m->occupancy);
+  free(m->retired);
+  free(m);
+}
+
+//makes the statistics of a finished run the reported ones
+static void report_machine(tom_machine_t *m) {
+  int i;
+  tom_stats = m->stats;
+  if (!m->occupancy)
+    return;
+
+  tom_occupancy_finish(m->occupancy);
+  for (i = 0; i < occ_num_stats; i++) {
+    const counter_t *histogram = tom_occupancy_histogram(m->occupancy, i);
+    int value;
+    occ_means[i] = tom_occupancy_mean(m->occupancy, i);
+    for (value = 0; value <= occ_capacity[i]; value++) {
+      //the distribution counts in ints
+      counter_t left = histogram[value];
+      for (; left > INT_MAX; left -= INT_MAX)
+        stat_add_samples(occ_dists[i], value, INT_MAX);
+      if (left)
+        stat_add_samples(occ_dists[i], value, (int)left);
+    }
+  }
+}
+
+//ticks through every single cycle of the simulation
+static counter_t run_every_cycle(tom_machine_t *m) {
+  const tom_machine_fns_t *fns = select_machine(m->cfg);
+
   int cycle = 1;
   while (true) {
-    if (cycle % 100 == 0) printf("Cycle #: %d \n", cycle);
+    if (m->progress && cycle % 100 == 0) printf("Cycle #: %d \n", cycle);
      /* ECE552: YOUR CODE GOES HERE */
-    //   fetch(trace, cycle);
-                int debug = 0;    
-                if(debug) printf("F2D\n");
-      fetch_To_dispatch(trace, cycle);
-                if(debug) printf("D2I\n");
-      dispatch_To_issue(cycle);
-                if(debug) printf("I2E\n");
-      issue_To_execute(cycle);
-                if(debug) printf("E2C\n");
-      execute_To_CDB(cycle);
-                if(debug) printf("C2R\n");
-      CDB_To_retire(cycle);
-
-
-//                debug_cycle(cycle);
+     fns->simulate_cycle(m, cycle);
 
      cycle++;
-     if (is_simulation_done(sim_num_insn))
+     if (is_simulation_done(m, m->num_insn))
         break;
   }
   
   return cycle; 
 }
 
-void debug_cycle(int cycle) {
-    printf("Cycle: %d\n", cycle);
+//only simulates the cycles in which the machine state can change
+static counter_t run_skipping_cycles(tom_machine_t *m) {
+  const tom_machine_fns_t *fns = select_machine(m->cfg);
 
-    int i = 0;
-    int count = 0;
+  int cycle = 1;
+  while (true) {
+    if (m->progress && cycle % 100 == 0) printf("Cycle #: %d \n", cycle);
+     fns->simulate_cycle(m, cycle);
 
-    for(i = 0; i < INSTR_QUEUE_SIZE; i++) {
-        if(instr_queue[i] != NULL) {
-            count++;
-             printf("\tinstr: %d->", instr_queue[i]->index);
-        }
+     if (is_simulation_done(m, m->num_insn))
+        break;
+
+     int next = fns->next_event_cycle(m, cycle);
+     if (next == INT_MAX)
+        panic("Tomasulo deadlock at cycle %d: no stage can make progress", cycle);
+     cycle = next;
+  }
+  
+  return cycle + 1; 
+}
+
+//runs a fresh machine over the whole trace
+static counter_t run_machine(tom_machine_t *m) {
+  return tom_skip_cycles ? run_skipping_cycles(m) : run_every_cycle(m);
+}
+
+/* 
+ * Description: 
+ * 	Runs the trace through both the per-cycle and the cycle-skipping loop and
+ *      checks that they agree on the cycle count and on every instruction's timing
+ * Inputs:
+ *      trace: instruction trace with all the instructions executed
+ * Returns:
+ * 	The total number of cycles it takes to execute the instructions.
+ */
+static counter_t run_skip_check(instruction_trace_t* trace) {
+  int i;
+  tom_timing_t *expected = calloc(sim_num_insn + 1, sizeof(tom_timing_t));
+  tom_timing_t *actual = calloc(sim_num_insn + 1, sizeof(tom_timing_t));
+  if (!expected || !actual)
+    fatal("out of virtual memory");
+
+  tom_machine_t *every = create_machine(&machine_config, trace, sim_num_insn);
+  every->timing_log = expected;
+  counter_t every_cycles = run_every_cycle(every);
+  destroy_machine(every);
+
+  tom_machine_t *skip = create_machine(&machine_config, trace, sim_num_insn);
+  skip->timing_log = actual;
+  skip->writeback = true;
+  skip->progress = tomasulo_progress;
+  attach_occupancy(skip);
+  counter_t skip_cycles = run_skipping_cycles(skip);
+  report_machine(skip);
+  destroy_machine(skip);
+
+  if (skip_cycles != every_cycles)
+    fatal("cycle skipping took %lld cycles, per-cycle loop took %lld",
+          (long long)skip_cycles, (long long)every_cycles);
+
+  for (i = 0; i <= sim_num_insn; i++) {
+    if (memcmp(&actual[i], &expected[i], sizeof(tom_timing_t)) != 0)
+      fatal("cycle skipping diverged at instruction %d: got %d/%d/%d/%d/%d, expected %d/%d/%d/%d/%d",
+            i, actual[i].dispatch, actual[i].issue, actual[i].execute, actual[i].cdb, actual[i].commit,
+            expected[i].dispatch, expected[i].issue, expected[i].execute, expected[i].cdb,
+            expected[i].commit);
+  }
+
+  free(expected);
+  free(actual);
+  fprintf(stderr, "cycle skipping check passed: %lld cycles\n", (long long)skip_cycles);
+  return skip_cycles;
+}
+
+/* REFERENCE MODEL */
+
+//A deliberately plain model of the same machine, for -tom:check_ref. It has no masks, tags,
+//age matrices, cycle skipping or specialized copies: every cycle it scans the instructions
+//in flight in program order, and an instruction's operands are ready once the instructions
+//it read them from have broadcast, rather than when a wakeup reaches it. It shares only the
+//configuration, the branch predictors and the caches with the machine it checks.
+
+//what the reference model does with an opcode: a reservation station class, or one of these
+enum ref_kind { REF_BRANCH = NUM_RS_CLASSES, REF_SKIP, REF_OTHER };
+
+//the reference model's state of an instruction of the trace
+typedef struct ref_instr
+{
+  tom_timing_t timing;           //stage cycles, compared with the machine's
+  int done;                      //cycle its result is ready, once executing
+  int ready;                     //first cycle it can commit in, INT_MAX until then
+  int unit;                      //functional unit it executes on
+  int producers[NUM_INPUT_REGS]; //instructions it read its operands from, -1 for the register file
+}ref_instr_t;
+
+typedef struct ref_model
+{
+  const tom_config_t *cfg;
+  instruction_trace_t *trace;
+  counter_t num_insn;
+  ref_instr_t *instr;            //by trace index
+
+  //pool and latency of every opcode
+  int pool[OP_MAX];
+  int latency[OP_MAX];
+
+  //the instruction queue, the reservation stations (both classes), the load/store queue and
+  //the reorder buffer, as lists of trace indices in program order
+  int ifq[INSTR_QUEUE_MAX_SIZE];
+  int ifq_count;
+  int window[NUM_RS_CLASSES * RS_MAX_SIZE];
+  int window_count;
+  int rs_count[NUM_RS_CLASSES];
+  int lsq[LSQ_MAX_SIZE];
+  int lsq_count;
+  int rob[ROB_MAX_SIZE];
+  int rob_count;
+
+  int map[MD_TOTAL_REGS];        //instruction in flight producing each register, -1 if none
+  int prf_free;                  //free physical registers
+  int fu_next[NUM_FU_POOLS][FU_MAX_SIZE];
+  int fetch_index;
+  int fetch_resume;
+  int mispredict;                //mispredicted branch fetch waits on, -1 if none
+  tom_bpred_t *bpred;
+  tom_cache_t *dcache;
+  tom_cache_stats_t cache_stats;
+}ref_model_t;
+
+static int ref_kind(enum md_opcode op) {
+  if (op == 0 || IS_TRAP(op))
+    return REF_SKIP;
+  if (IS_BRANCH(op))
+    return REF_BRANCH;
+  if (IS_FCOMP(op))
+    return RS_FP;
+  if (USES_INT_FU(op))
+    return RS_INT;
+  return REF_OTHER;
+}
+
+//physical registers an instruction renames
+static int ref_dests(const instruction_t *instr) {
+  int k;
+  int dests = 0;
+  for (k = 0; k < NUM_OUTPUT_REGS; k++)
+    dests += instr->r_out[k] != -1 && instr->r_out[k] != 0;
+  return dests;
+}
+
+//takes the i-th entry out of a list
+static void ref_remove(int *list, int *count, int i) {
+  memmove(&list[i], &list[i + 1], (*count - i - 1) * sizeof(int));
+  (*count)--;
+}
+
+//true once every instruction the instruction reads from has broadcast
+static bool ref_operands_ready(ref_model_t *r, int index) {
+  int k;
+  for (k = 0; k < NUM_INPUT_REGS; k++) {
+    int p = r->instr[index].producers[k];
+    if (p != -1 && r->instr[p].timing.cdb == 0)
+      return false;
+  }
+  return true;
+}
+
+//a dispatched mispredicted branch resolves the cycle after it has its operands; this runs at
+//the start of the cycle after that
+static void ref_resolve(ref_model_t *r) {
+  int b = r->mispredict;
+  int k;
+  if (b == -1 || r->instr[b].timing.dispatch == 0 || !ref_operands_ready(r, b))
+    return;
+
+  int resolve = r->instr[b].timing.dispatch + 1;
+  for (k = 0; k < NUM_INPUT_REGS; k++) {
+    int p = r->instr[b].producers[k];
+    if (p != -1)
+      resolve = MAX(resolve, r->instr[p].timing.cdb + 1);
+  }
+  r->fetch_resume = resolve + r->cfg->bpred_penalty;
+  r->instr[b].ready = resolve + 1;
+  r->mispredict = -1;
+}
+
+static void ref_commit(ref_model_t *r, int cycle) {
+  int n;
+  for (n = 0; n < r->cfg->dispatch_width && r->rob_count; n++) {
+    ref_instr_t *head = &r->instr[r->rob[0]];
+    if (head->ready > cycle)
+      return;
+    head->timing.commit = cycle;
+    if (ref_kind(get_instr(r->trace, r->rob[0])->op) != REF_BRANCH)
+      r->prf_free += ref_dests(get_instr(r->trace, r->rob[0]));
+    ref_remove(r->rob, &r->rob_count, 0);
+  }
+}
+
+static void ref_fetch(ref_model_t *r, int cycle) {
+  const tom_config_t *cfg = r->cfg;
+  int n;
+  if (r->mispredict != -1 || cycle < r->fetch_resume || r->ifq_count == cfg->ifq_size)
+    return;
+
+  for (n = 0; n < cfg->fetch_width; n++) {
+    if (r->fetch_index > r->num_insn)
+      return;
+    instruction_t *instr = get_instr(r->trace, r->fetch_index);
+    while (ref_kind(instr->op) == REF_SKIP) {
+      if (++r->fetch_index > r->num_insn)
+        return;
+      instr = get_instr(r->trace, r->fetch_index);
     }
-    printf("\tNum In IFQ: %d\n\n", count);
-    count = 0;
-    for (i = 0; i < RESERV_INT_SIZE; i++) {
-        if (reservINT[i] != NULL) {
-            count++;
-            printf("\tinstr: %d,", reservINT[i]->index);
-        }
+    if (r->ifq_count == cfg->ifq_size)
+      return;
+
+    int index = r->fetch_index++;
+    r->ifq[r->ifq_count++] = index;
+    if (IS_COND_CTRL(instr->op) && cfg->bpred != BPRED_PERFECT) {
+      //taken unless the next instruction in the trace follows it
+      bool taken = index + 1 < r->trace->total_size
+                   && get_instr(r->trace, index + 1)->pc != instr->pc + sizeof(md_inst_t);
+      if (!tom_bpred_update(r->bpred, instr->pc, taken)) {
+        r->mispredict = index;
+        return;
+      }
     }
-    printf("\tNum In rINT: %d\n", count);
-    count = 0;
-    for (i = 0; i < RESERV_FP_SIZE; i++) {
-        if (reservFP[i] != NULL) {
-            count++;
-            printf("\tinstr: %d,", reservFP[i]->index);
-        }
+  }
+}
+
+static void ref_dispatch(ref_model_t *r, int cycle) {
+  const tom_config_t *cfg = r->cfg;
+  int n;
+  int k;
+
+  for (n = 0; n < cfg->dispatch_width && r->ifq_count; n++) {
+    int index = r->ifq[0];
+    instruction_t *instr = get_instr(r->trace, index);
+    ref_instr_t *ri = &r->instr[index];
+    int kind = ref_kind(instr->op);
+    bool memory = IS_LOAD(instr->op) || IS_STORE(instr->op);
+
+    if (kind == REF_OTHER || (cfg->rob_size && r->rob_count == cfg->rob_size))
+      return;
+    if (kind != REF_BRANCH && ((cfg->lsq_size && memory && r->lsq_count == cfg->lsq_size)
+                               || r->rs_count[kind] == rs_size(cfg, kind)
+                               || (cfg->prf_size && r->prf_free < ref_dests(instr))))
+      return;
+
+    ref_remove(r->ifq, &r->ifq_count, 0);
+    ri->timing.dispatch = cycle;
+    for (k = 0; k < NUM_INPUT_REGS; k++)
+      ri->producers[k] = instr->r_in[k] != -1 ? r->map[instr->r_in[k]] : -1;
+    if (cfg->rob_size)
+      r->rob[r->rob_count++] = index;
+
+    //branches do not wait in the stations, and a correctly predicted one is resolved at once
+    if (kind == REF_BRANCH) {
+      ri->ready = index == r->mispredict ? INT_MAX : cycle + 1;
+      continue;
     }
-    printf("\tNum In rFP: %d\n\n", count);
-    count = 0;
-    for (i = 0; i < FU_INT_SIZE; i++) {
-        if (fuINT[i] != NULL) count++;
+    ri->ready = INT_MAX;
+    r->window[r->window_count++] = index;
+    r->rs_count[kind]++;
+    r->prf_free -= ref_dests(instr);
+    if (cfg->lsq_size && memory)
+      r->lsq[r->lsq_count++] = index;
+    for (k = 0; k < NUM_OUTPUT_REGS; k++) {
+      if (instr->r_out[k] != -1 && instr->r_out[k] != 0)
+        r->map[instr->r_out[k]] = index;
     }
-    printf("\tNum In fuINT: %d\n", count);
-    count = 0;
-    for (i = 0; i < FU_FP_SIZE; i++) {
-        if (fuFP[i] != NULL) count++;
+  }
+}
+
+static void ref_issue(ref_model_t *r, int cycle) {
+  int i;
+  for (i = 0; i < r->window_count; i++) {
+    ref_instr_t *ri = &r->instr[r->window[i]];
+    if (ri->timing.issue == 0 && ri->timing.dispatch < cycle)
+      ri->timing.issue = cycle;
+  }
+}
+
+//true if an older store to the same word keeps the load from executing in the cycle; sets
+//forward if an older store to the same address has the load's data
+static bool ref_load_blocked(ref_model_t *r, int load, int cycle, bool *forward) {
+  md_addr_t addr = get_instr(r->trace, load)->mem_addr;
+  int i;
+
+  *forward = false;
+  for (i = 0; r->lsq[i] != load; i++);
+  //the closest older store to the word decides
+  for (i--; i >= 0; i--) {
+    instruction_t *store = get_instr(r->trace, r->lsq[i]);
+    ref_instr_t *rs = &r->instr[r->lsq[i]];
+    if (!IS_STORE(store->op) || LSQ_WORD(store->mem_addr) != LSQ_WORD(addr))
+      continue;
+
+    bool left = rs->timing.cdb != 0;
+    if (store->mem_addr == addr && (left || (rs->timing.execute != 0 && rs->done <= cycle))) {
+      *forward = true;
+      return false;
     }
-    printf("\tNum In fuFP: %d\n\n", count);
-    printf("\tID In CDB: %d\n\n", commonDataBus == NULL ? -1 : commonDataBus->index);
-    
+    if (!left)
+      return true;
+  }
+  return false;
+}
+
+//the oldest instruction of the pool that can start executing in the cycle, -1 if none can
+static int ref_select(ref_model_t *r, int pool, int cycle) {
+  int i;
+  for (i = 0; i < r->window_count; i++) {
+    int index = r->window[i];
+    instruction_t *instr = get_instr(r->trace, index);
+    ref_instr_t *ri = &r->instr[index];
+    bool forward;
+
+    if (r->pool[instr->op] != pool || ri->timing.issue == 0 || ri->timing.issue == cycle
+        || ri->timing.execute != 0 || !ref_operands_ready(r, index))
+      continue;
+    if (r->cfg->lsq_size && IS_LOAD(instr->op) && ref_load_blocked(r, index, cycle, &forward))
+      continue;
+    return index;
+  }
+  return -1;
+}
+
+static void ref_execute(ref_model_t *r, int cycle) {
+  const tom_config_t *cfg = r->cfg;
+  int p;
+  int u;
+
+  for (p = 0; p < NUM_FU_POOLS; p++) {
+    for (u = 0; u < cfg->fu[p].count; u++) {
+      if (r->fu_next[p][u] > cycle)
+        continue;
+      int index = ref_select(r, p, cycle);
+      if (index == -1)
+        break;
+
+      instruction_t *instr = get_instr(r->trace, index);
+      ref_instr_t *ri = &r->instr[index];
+      bool forward = false;
+      ri->timing.execute = cycle;
+      ri->unit = u;
+      ri->done = cycle + r->latency[instr->op];
+      if (cfg->lsq_size && IS_LOAD(instr->op))
+        ref_load_blocked(r, index, cycle, &forward);
+      if (forward)
+        ri->done = cycle + cfg->lsq_fwd_latency;
+      else if (r->dcache && IS_LOAD(instr->op))
+        ri->done = tom_cache_load(r->dcache, instr->mem_addr, cycle, &r->cache_stats);
+      else if (r->dcache && IS_STORE(instr->op))
+        tom_cache_store(r->dcache, instr->mem_addr, cycle, &r->cache_stats);
+      r->fu_next[p][u] = cfg->fu[p].interval ? cycle + cfg->fu[p].interval : INT_MAX;
+    }
+  }
+}
+
+//the oldest finished instructions broadcast on the buses and leave the stations
+static void ref_writeback(ref_model_t *r, int cycle) {
+  const tom_config_t *cfg = r->cfg;
+  int bus;
+  int i;
+  int k;
+
+  for (bus = 0; bus < cfg->num_cdb; bus++) {
+    for (i = 0; i < r->window_count; i++) {
+      ref_instr_t *ri = &r->instr[r->window[i]];
+      if (ri->timing.execute != 0 && ri->done <= cycle)
+        break;
+    }
+    if (i == r->window_count)
+      break;
+
+    int index = r->window[i];
+    instruction_t *instr = get_instr(r->trace, index);
+    ref_instr_t *ri = &r->instr[index];
+    int pool = r->pool[instr->op];
+    ri->timing.cdb = cycle;
+    ri->ready = cycle + 1;
+    if (!cfg->fu[pool].interval)
+      r->fu_next[pool][ri->unit] = cycle + 1;
+    for (k = 0; k < NUM_OUTPUT_REGS; k++) {
+      if (instr->r_out[k] != -1 && instr->r_out[k] != 0 && r->map[instr->r_out[k]] == index)
+        r->map[instr->r_out[k]] = -1;
+    }
+    ref_remove(r->window, &r->window_count, i);
+    r->rs_count[ref_kind(instr->op)]--;
+    if (!cfg->rob_size)
+      r->prf_free += ref_dests(instr);
+  }
+
+  //loads and stores leave the queue once every older one has left
+  while (r->lsq_count && r->instr[r->lsq[0]].timing.cdb != 0)
+    ref_remove(r->lsq, &r->lsq_count, 0);
+}
+
+static ref_model_t *ref_create(const tom_config_t *cfg, instruction_trace_t* trace, counter_t num_insn) {
+  ref_model_t *r = calloc(1, sizeof(ref_model_t));
+  if (!r || !(r->instr = calloc(num_insn + 1, sizeof(ref_instr_t))))
+    fatal("out of virtual memory");
+
+  r->cfg = cfg;
+  r->trace = trace;
+  r->num_insn = num_insn;
+  int op;
+  for (op = 0; op < OP_MAX; op++) {
+    int pool = fu_pool_of(op, IS_FCOMP(op) ? RS_FP : RS_INT);
+    r->latency[op] = op_lat_override[op] ? op_lat_override[op] : cfg->fu[pool].latency;
+    r->pool[op] = cfg->fu[pool].count ? pool : fu_pools[pool].base;
+  }
+  int reg;
+  for (reg = 0; reg < MD_TOTAL_REGS; reg++)
+    r->map[reg] = -1;
+  r->mispredict = -1;
+  r->prf_free = cfg->prf_size - MD_TOTAL_REGS;
+  r->bpred = tom_bpred_create(cfg->bpred, cfg->bpred_bits);
+  r->dcache = cfg->cache.l1d_kb ? tom_cache_create(&cfg->cache) : NULL;
+  return r;
+}
+
+static void ref_free(ref_model_t *r) {
+  tom_bpred_free(r->bpred);
+  tom_cache_free(r->dcache);
+  free(r->instr);
+  free(r);
+}
+
+//runs the reference model a cycle at a time; returns the cycles it took, or 0 if it had not
+//finished by the limit
+static counter_t ref_run(ref_model_t *r, counter_t limit) {
+  int cycle;
+  for (cycle = 1; cycle < limit; cycle++) {
+    ref_resolve(r);
+    ref_commit(r, cycle);
+    ref_fetch(r, cycle);
+    ref_dispatch(r, cycle);
+    ref_issue(r, cycle);
+    ref_execute(r, cycle);
+    ref_writeback(r, cycle);
+    if (r->fetch_index > r->num_insn && !r->ifq_count && !r->window_count && !r->rob_count)
+      return cycle + 1;
+  }
+  return 0;
+}
+
+/*
+ * Description:
+ * 	Runs the trace through the machine and through the reference model, and checks that
+ *      they agree on every instruction's stage cycles and on the cycle count. The first
+ *      instruction they disagree on is reported.
+ * Inputs:
+ *      trace: instruction trace with all the instructions executed
+ * Returns:
+ * 	The total number of cycles it takes to execute the instructions.
+ */
+static counter_t run_ref_check(instruction_trace_t* trace) {
+  int i;
+  tom_timing_t *actual = calloc(sim_num_insn + 1, sizeof(tom_timing_t));
+  if (!actual)
+    fatal("out of virtual memory");
+
+  tom_machine_t *m = create_machine(&machine_config, trace, sim_num_insn);
+  m->timing_log = actual;
+  m->writeback = true;
+  m->progress = tomasulo_progress;
+  attach_occupancy(m);
+  counter_t cycles = run_machine(m);
+  report_machine(m);
+  destroy_machine(m);
+
+  //the model gets a cycle more than the machine took, to tell a longer run from an equal one
+  ref_model_t *r = ref_create(&machine_config, trace, sim_num_insn);
+  counter_t ref_cycles = ref_run(r, cycles + 1);
+
+  for (i = 0; i <= sim_num_insn; i++) {
+    const tom_timing_t *expected = &r->instr[i].timing;
+    if (memcmp(&actual[i], expected, sizeof(tom_timing_t)) != 0)
+      fatal("diverged from the reference model at instruction %d (%s): got %d/%d/%d/%d/%d, "
+            "expected %d/%d/%d/%d/%d", i, MD_OP_NAME(get_instr(trace, i)->op),
+            actual[i].dispatch, actual[i].issue, actual[i].execute, actual[i].cdb, actual[i].commit,
+            expected->dispatch, expected->issue, expected->execute, expected->cdb, expected->commit);
+  }
+  if (ref_cycles != cycles)
+    fatal("the machine took %lld cycles, the reference model %s %lld", (long long)cycles,
+          ref_cycles ? "took" : "had not finished after", (long long)(ref_cycles ? ref_cycles : cycles));
+
+  ref_free(r);
+  free(actual);
+  fprintf(stderr, "reference model check passed: %lld cycles\n", (long long)cycles);
+  return cycles;
+}
+
+/* SAMPLED SIMULATION */
+
+//a checkpoint file holds this header, the machine configuration, the machine, and the state of
+//its branch predictor and caches. It is only meant to be read back by the same build
+#define CKPT_MAGIC   "TOMCKPT"
+#define CKPT_VERSION 1
+
+typedef struct ckpt_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t machine_size;   //sizeof(tom_machine_t)
+  int32_t interval;        //the interval the machine is at the start of
+  int32_t first, last;     //its first and last instruction
+}ckpt_header_t;
+
+//simulates a machine from the cycle it stopped at until fetch has taken every instruction
+//before the index; returns false if the run ended first
+static bool run_until_fetched(tom_machine_t *m, const tom_machine_fns_t *fns, int index) {
+  while (m->fetch_index < index) {
+    int next = m->cycle == 0 || !tom_skip_cycles ? m->cycle + 1 : fns->next_event_cycle(m, m->cycle);
+    if (next == INT_MAX)
+      panic("Tomasulo deadlock at cycle %d: no stage can make progress", m->cycle);
+    fns->simulate_cycle(m, next);
+    if (is_simulation_done(m, m->num_insn))
+      return false;
+  }
+  return true;
+}
+
+//simulates a machine fetch has just brought to the first instruction of an interval until it
+//has taken the last one; returns the cycles that took. The interval that ends the trace runs
+//until the machine drains, and counts its last cycle like a whole run does
+static int run_interval(tom_machine_t *m, const tom_machine_fns_t *fns, int last) {
+  int boundary = m->cycle;
+  //fetch never reaches INT_MAX, so run_until_fetched stops once the machine is done
+  if (last == sim_num_insn) {
+    run_until_fetched(m, fns, INT_MAX);
+    return m->cycle + 1 - boundary;
+  }
+  run_until_fetched(m, fns, last + 1);
+  return m->cycle - boundary;
+}
+
+//trains a predictor and caches on the instructions [from, to) without timing them
+static void warm_functionally(instruction_trace_t* trace, tom_bpred_t *bpred, tom_cache_t *dcache,
+                              int from, int to) {
+  int i;
+  for (i = from; i < to; i++) {
+    const instr_hot_t *hot = get_instr_hot(trace, i);
+    if ((hot->flags & INSTR_COND) && machine_config.bpred != BPRED_PERFECT)
+      tom_bpred_update(bpred, get_instr(trace, i)->pc, (hot->flags & INSTR_TAKEN) != 0);
+    if (dcache && (hot->flags & (INSTR_LOAD | INSTR_STORE)))
+      tom_cache_touch(dcache, get_instr(trace, i)->mem_addr);
+  }
+}
+
+//adds the counts of a run to a total (every field of tom_stats_t is a counter_t)
+static void add_stats(tom_stats_t *total, const tom_stats_t *stats) {
+  counter_t *sum = (counter_t *)total;
+  const counter_t *add = (const counter_t *)stats;
+  int i;
+  for (i = 0; i < (int)(sizeof(tom_stats_t) / sizeof(counter_t)); i++)
+    sum[i] += add[i];
+}
+
+//writes the machine, at the start of an interval, to the checkpoint file of the interval
+static void save_checkpoint(tom_machine_t *m, int interval, int first, int last) {
+  char path[1024];
+  ckpt_header_t header;
+  snprintf(path, sizeof(path), "%s.%d", simpoint_ckpt_prefix, interval);
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    fatal("cannot open checkpoint file `%s' for writing", path);
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CKPT_MAGIC, sizeof(header.magic));
+  header.version = CKPT_VERSION;
+  header.machine_size = sizeof(tom_machine_t);
+  header.interval = interval;
+  header.first = first;
+  header.last = last;
+  fwrite(&header, sizeof(header), 1, f);
+  fwrite(m->cfg, sizeof(tom_config_t), 1, f);
+  fwrite(m, sizeof(tom_machine_t), 1, f);
+  tom_bpred_save(m->bpred, f);
+  if (m->dcache)
+    tom_cache_save(m->dcache, f);
+  if (ferror(f) || fclose(f) != 0)
+    fatal("cannot write checkpoint file `%s'", path);
+}
+
+//reads a checkpoint back into a machine over the trace; the machine configuration must be the
+//one it was taken with
+static tom_machine_t *load_checkpoint(const char *path, instruction_trace_t* trace, ckpt_header_t *header) {
+  tom_config_t cfg;
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    fatal("cannot open checkpoint file `%s'", path);
+
+  if (fread(header, sizeof(*header), 1, f) != 1 || memcmp(header->magic, CKPT_MAGIC, sizeof(header->magic))
+      || header->version != CKPT_VERSION || header->machine_size != sizeof(tom_machine_t))
+    fatal("`%s' is not a checkpoint of this simulator", path);
+  if (fread(&cfg, sizeof(cfg), 1, f) != 1 || memcmp(&cfg, &machine_config, sizeof(cfg)))
+    fatal("checkpoint `%s' was taken with another machine configuration", path);
+  if (header->last > sim_num_insn)
+    fatal("checkpoint `%s' is of a trace longer than this one", path);
+
+  //the pointers of the saved machine mean nothing any more; keep the new machine's
+  tom_machine_t *m = create_machine(&machine_config, trace, header->last);
+  tom_bpred_t *bpred = m->bpred;
+  tom_cache_t *dcache = m->dcache;
+  if (fread(m, sizeof(tom_machine_t), 1, f) != 1)
+    fatal("checkpoint `%s' is truncated", path);
+  m->cfg = &machine_config;
+  m->trace = trace;
+  m->bpred = bpred;
+  m->dcache = dcache;
+  m->timing_log = NULL;
+  m->occupancy = NULL;
+  m->pipeview = NULL;
+  m->retired = NULL;
+  if (!tom_bpred_restore(bpred, f) || (dcache && !tom_cache_restore(dcache, f)))
+    fatal("checkpoint `%s' is truncated", path);
+  fclose(f);
+  return m;
+}
+
+/*
+ * Description:
+ * 	Simulates a sample of the trace in detail and extrapolates the cycles of the whole run.
+ *      The intervals picked by tom_simpoint_analyze are simulated in trace order; in between,
+ *      the branch predictor and the caches are trained functionally. Each interval starts on a
+ *      fresh machine -tom:simpoint_warmup instructions early, and is measured from the cycle
+ *      fetch reaches it to the cycle fetch has taken all of it. Every cluster takes the mean CPI
+ *      of its sampled intervals; their spread gives a 95% confidence bound.
+ * Inputs:
+ *      trace: instruction trace with all the instructions executed
+ * Returns:
+ * 	The estimated number of cycles it takes to execute the instructions.
+ * Extra Notes:
+ * 	tom_stats sums the counts of the measured intervals; instructions outside the intervals
+ *      and their warmups keep no stage cycles in the trace
+ */
+static counter_t run_sampled(instruction_trace_t* trace) {
+  tom_simpoints_t *sp = tom_simpoint_analyze(trace, sim_num_insn, simpoint_interval, simpoint_max_k,
+                                             simpoint_per_cluster, simpoint_seed);
+  double *cpi = calloc(sp->samples, sizeof(double));
+  tom_bpred_t *warm_bpred = tom_bpred_create(machine_config.bpred, machine_config.bpred_bits);
+  tom_cache_t *warm_dcache = machine_config.cache.l1d_kb ? tom_cache_create(&machine_config.cache) : NULL;
+  const tom_machine_fns_t *fns = select_machine(&machine_config);
+  counter_t detailed = 0;
+  int warmed = 1;
+  int s;
+  int c;
+  if (!cpi)
+    fatal("out of virtual memory");
+
+  memset(&tom_stats, 0, sizeof(tom_stats));
+  for (s = 0; s < sp->samples; s++) {
+    int first = tom_simpoint_first(sp, sp->sample[s]);
+    int last = tom_simpoint_last(sp, sp->sample[s]);
+    int start = MAX(1, first - simpoint_warmup);
+
+    warm_functionally(trace, warm_bpred, warm_dcache, warmed, start);
+    warmed = start;
+    tom_machine_t *m = create_machine(&machine_config, trace, last);
+    m->fetch_index = start;
+    m->writeback = true;
+    tom_bpred_copy(m->bpred, warm_bpred);
+    if (m->dcache)
+      tom_cache_copy(m->dcache, warm_dcache);
+
+    run_until_fetched(m, fns, first);
+    memset(&m->stats, 0, sizeof(m->stats));
+    if (simpoint_ckpt_prefix)
+      save_checkpoint(m, sp->sample[s], first, last);
+    cpi[s] = (double)run_interval(m, fns, last) / (last - first + 1);
+    add_stats(&tom_stats, &m->stats);
+    detailed += last - start + 1;
+    destroy_machine(m);
+  }
+
+  //stratified estimate: the intervals of a cluster run at the mean CPI of its samples
+  double estimate = 0;
+  double variance = 0;
+  int unbounded = 0;
+  for (c = 0; c < sp->clusters; c++) {
+    double sum = 0, sum2 = 0, insts = 0;
+    int n = 0, members = 0;
+    int i;
+    for (s = 0; s < sp->samples; s++) {
+      if (sp->cluster[sp->sample[s]] != c)
+        continue;
+      sum += cpi[s];
+      sum2 += cpi[s] * cpi[s];
+      n++;
+    }
+    for (i = 0; i < sp->intervals; i++) {
+      if (sp->cluster[i] != c)
+        continue;
+      insts += tom_simpoint_last(sp, i) - tom_simpoint_first(sp, i) + 1;
+      members++;
+    }
+    double mean = sum / n;
+    estimate += insts * mean;
+    if (n > 1)
+      variance += insts * insts * MAX(0.0, (sum2 - n * mean * mean) / (n - 1)) / n
+                  * (1 - (double)n / members);
+    else if (members > 1)
+      unbounded++;
+  }
+
+  fprintf(stderr, "sampled simulation: %d intervals of %d instructions in %d clusters; %d intervals "
+          "(%lld instructions with their warmup) simulated in detail\n", sp->intervals,
+          sp->interval_size, sp->clusters, sp->samples, (long long)detailed);
+  fprintf(stderr, "estimated cycles: %.0f +- %.0f (95%% confidence%s)\n", estimate, 1.96 * sqrt(variance),
+          unbounded ? "; clusters with a single sample add no error" : "");
+
+  tom_bpred_free(warm_bpred);
+  tom_cache_free(warm_dcache);
+  tom_simpoint_free(sp);
+  free(cpi);
+  return (counter_t)(estimate + 0.5);
+}
+
+//simulates the interval of the -tom:simpoint_restore checkpoint on its own; returns its cycles
+static counter_t run_checkpoint(instruction_trace_t* trace) {
+  ckpt_header_t header;
+  tom_machine_t *m = load_checkpoint(simpoint_restore_path, trace, &header);
+
+  m->writeback = true;
+  counter_t cycles = run_interval(m, select_machine(m->cfg), header.last);
+  report_machine(m);
+  destroy_machine(m);
+
+  fprintf(stderr, "interval %d (instructions %d to %d) from checkpoint: %lld cycles, CPI %.4f\n",
+          header.interval, header.first, header.last, (long long)cycles,
+          (double)cycles / (header.last - header.first + 1));
+  return cycles;
+}
+
+//true if the run needs the whole trace in memory, rather than streamed through the machine
+static bool needs_whole_trace(void) {
+  return tom_check_skip || tom_check_ref || sweep_num_specs > 0 || simpoint_interval > 0
+         || simpoint_restore_path || parallel_chunks > 0;
+}
+
+/* INTERVAL-PARALLEL SIMULATION */
+
+//a chunk of the trace simulated by its own thread, and its result
+typedef struct parallel_chunk
+{
+  instruction_trace_t *trace;
+  int start;              //first instruction simulated, warmup included
+  int first, last;        //the instructions measured
+  bool final;             //the chunk ends the run, so it runs until the machine drains
+  tom_timing_t *timing;   //stage cycles of [start, last], by index - start
+  int boundary;           //the cycle fetch reached the first instruction in
+  counter_t cycles;       //cycles measured
+  tom_stats_t stats;      //statistics of the measured cycles
+}parallel_chunk_t;
+
+//work shared by the parallel threads
+typedef struct parallel_job
+{
+  parallel_chunk_t *chunks;
+  int num_chunks;
+  int next_chunk;  //next chunk to hand out (taken atomically)
+}parallel_job_t;
+
+//simulates a chunk from a cold machine, warming it up on the instructions before the chunk
+static void simulate_chunk(parallel_chunk_t *chunk) {
+  const tom_machine_fns_t *fns = select_machine(&machine_config);
+  tom_machine_t *m = create_machine(&machine_config, chunk->trace, chunk->last);
+  m->fetch_index = chunk->start;
+  m->timing_log = chunk->timing;
+  m->log_first = chunk->start;
+
+  run_until_fetched(m, fns, chunk->first);
+  if (chunk->start < chunk->first)
+    memset(&m->stats, 0, sizeof(m->stats));
+  chunk->boundary = m->cycle;
+  //the final chunk is measured until the machine drains, and counts its last cycle like a
+  //whole run does; fetch never reaches INT_MAX, so that is when run_until_fetched stops
+  if (chunk->final) {
+    run_until_fetched(m, fns, INT_MAX);
+    chunk->cycles = m->cycle + 1 - chunk->boundary;
+    chunk->stats = m->stats;
+  }
+  else {
+    run_until_fetched(m, fns, chunk->last + 1);
+    chunk->cycles = m->cycle - chunk->boundary;
+    chunk->stats = m->stats;
+    //its last instructions still need their stage cycles
+    run_until_fetched(m, fns, INT_MAX);
+  }
+  destroy_machine(m);
+}
+
+//parallel thread: simulates chunks until there are none left
+static void *parallel_worker(void *arg) {
+  parallel_job_t *job = arg;
+  int k;
+
+  while ((k = __sync_fetch_and_add(&job->next_chunk, 1)) < job->num_chunks) {
+    simulate_chunk(&job->chunks[k]);
+  }
+  return NULL;
+}
+
+/*
+ * Description:
+ * 	Splits the trace into -tom:parallel chunks of consecutive instructions and simulates them
+ *      on -tom:sweep_threads threads, each taking the next chunk as it finishes one. Every
+ *      chunk starts from a cold machine -tom:parallel_warmup instructions early, which warms
+ *      up the queues, the branch predictor and the caches on the end of the chunk before it,
+ *      and is measured from the cycle fetch reaches it to the
+ *      cycle fetch has taken all of it. The total is the sum of the chunks, and each chunk's
+ *      stage cycles go into the trace shifted by the chunks before it.
+ *      With -tom:parallel_check, a serial run measured at the same boundaries gives the error
+ *      of every chunk.
+ * Inputs:
+ *      trace: instruction trace with all the instructions executed
+ * Returns:
+ * 	The estimated number of cycles it takes to execute the instructions.
+ */
+static counter_t run_parallel(instruction_trace_t* trace) {
+  int num_chunks = MIN(parallel_chunks, (int)sim_num_insn);
+  parallel_chunk_t *chunks = calloc(num_chunks, sizeof(parallel_chunk_t));
+  int num_threads = MIN(sweep_threads, num_chunks);
+  pthread_t *threads = calloc((size_t)num_threads, sizeof(pthread_t));
+  int i;
+  int k;
+  if (!chunks || !threads)
+    fatal("out of virtual memory");
+
+  for (k = 0; k < num_chunks; k++) {
+    parallel_chunk_t *chunk = &chunks[k];
+    chunk->trace = trace;
+    chunk->first = (int)(sim_num_insn * k / num_chunks) + 1;
+    chunk->last = (int)(sim_num_insn * (k + 1) / num_chunks);
+    chunk->start = MAX(1, chunk->first - parallel_warmup);
+    chunk->final = k == num_chunks - 1;
+    chunk->timing = calloc(chunk->last - chunk->start + 1, sizeof(tom_timing_t));
+    if (!chunk->timing)
+      fatal("out of virtual memory");
+  }
+
+  parallel_job_t job = { chunks, num_chunks, 0 };
+  for (i = 0; i < num_threads; i++) {
+    if (pthread_create(&threads[i], NULL, parallel_worker, &job) != 0)
+      fatal("could not start parallel thread %d", i);
+  }
+  for (i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  //stitch the chunks together; stage cycles move to where the chunk starts in the total
+  counter_t cycles = 0;
+  memset(&tom_stats, 0, sizeof(tom_stats));
+  for (k = 0; k < num_chunks; k++) {
+    parallel_chunk_t *chunk = &chunks[k];
+    int shift = (int)cycles - chunk->boundary;
+    for (i = chunk->first; i <= chunk->last; i++) {
+      const tom_timing_t *timing = &chunk->timing[i - chunk->start];
+      instruction_t *out = get_instr(trace, i);
+      out->tom_dispatch_cycle = timing->dispatch ? timing->dispatch + shift : 0;
+      out->tom_issue_cycle = timing->issue ? timing->issue + shift : 0;
+      out->tom_execute_cycle = timing->execute ? timing->execute + shift : 0;
+      out->tom_cdb_cycle = timing->cdb ? timing->cdb + shift : 0;
+      out->tom_commit_cycle = timing->commit ? timing->commit + shift : 0;
+    }
+    add_stats(&tom_stats, &chunk->stats);
+    cycles += chunk->cycles;
+  }
+
+  //the serial run, measured at the chunk boundaries
+  counter_t *serial = NULL;
+  if (parallel_check) {
+    const tom_machine_fns_t *fns = select_machine(&machine_config);
+    tom_machine_t *m = create_machine(&machine_config, trace, sim_num_insn);
+    int boundary = 0;
+    serial = calloc(num_chunks, sizeof(counter_t));
+    if (!serial)
+      fatal("out of virtual memory");
+    for (k = 0; k < num_chunks - 1; k++) {
+      run_until_fetched(m, fns, chunks[k].last + 1);
+      serial[k] = m->cycle - boundary;
+      boundary = m->cycle;
+    }
+    run_until_fetched(m, fns, INT_MAX);
+    serial[k] = m->cycle + 1 - boundary;
+    destroy_machine(m);
+  }
+
+  fprintf(stderr, "\nTomasulo parallel run: %d chunks on %d threads, %d instructions of warmup\n",
+          num_chunks, num_threads, parallel_warmup);
+  fprintf(stderr, "%5s %10s %10s %12s %8s", "chunk", "first", "last", "cycles", "CPI");
+  if (serial)
+    fprintf(stderr, " %12s %8s", "serial", "error");
+  fprintf(stderr, "\n");
+  counter_t serial_total = 0;
+  for (k = 0; k < num_chunks; k++) {
+    parallel_chunk_t *chunk = &chunks[k];
+    fprintf(stderr, "%5d %10d %10d %12lld %8.4f", k, chunk->first, chunk->last,
+            (long long)chunk->cycles, (double)chunk->cycles / (chunk->last - chunk->first + 1));
+    if (serial) {
+      fprintf(stderr, " %12lld %+7.2f%%", (long long)serial[k],
+              100.0 * ((double)chunk->cycles - serial[k]) / serial[k]);
+      serial_total += serial[k];
+    }
+    fprintf(stderr, "\n");
+  }
+  fprintf(stderr, "%27s %12lld", "total", (long long)cycles);
+  if (serial)
+    fprintf(stderr, " %8s %12lld %+7.2f%%", "", (long long)serial_total,
+            100.0 * ((double)cycles - serial_total) / serial_total);
+  fprintf(stderr, "\n");
+
+  for (k = 0; k < num_chunks; k++)
+    free(chunks[k].timing);
+  free(chunks);
+  free(threads);
+  free(serial);
+  return cycles;
+}
+
+/* PIPELINE VIEWER EXPORT */
+
+//opens the -tom:pipe_out file, NULL if there is none
+static tom_pipeview_t *open_pipeview(void) {
+  if (!pipe_out_path)
+    return NULL;
+
+  int format = tom_pipeview_lookup(pipe_format_option);
+  if (format == -1)
+    fatal("unknown pipeline viewer format `%s'", pipe_format_option);
+
+  //a window without its last value runs to the end
+  int first_index = pipe_num_insts > 0 ? pipe_insts[0] : 0;
+  int last_index = pipe_num_insts > 1 ? pipe_insts[1] : INT_MAX;
+  int first_cycle = pipe_num_cycles > 0 ? pipe_cycles[0] : 0;
+  int last_cycle = pipe_num_cycles > 1 ? pipe_cycles[1] : INT_MAX;
+  if (last_index < first_index || last_cycle < first_cycle)
+    fatal("-tom:pipe_insts and -tom:pipe_cycles take a first and a last value, in order");
+
+  return tom_pipeview_open(pipe_out_path, format, first_index, last_index, first_cycle, last_cycle);
+}
+
+//exports the stages the run wrote into the trace to the -tom:pipe_out file, if there is one
+static void export_pipeview(instruction_trace_t* trace) {
+  tom_pipeview_t *view = open_pipeview();
+  int index;
+  if (!view)
+    return;
+
+  for (index = MAX(1, pipe_num_insts > 0 ? pipe_insts[0] : 1);
+       index <= sim_num_insn && index < trace->total_size; index++) {
+    instruction_t *instr = get_instr(trace, index);
+    tom_pipeview_instr(view, instr);
+    if (tom_pipeview_done(view, instr))
+      break;
+  }
+  tom_pipeview_close(view);
+}
+
+/* STREAMING */
+
+//the machine fed by tomasulo_stream_put, and its cycle code
+static tom_machine_t *stream_machine = NULL;
+static const tom_machine_fns_t *stream_fns = NULL;
+
+//single-producer, single-consumer ring from the functional simulator to the streaming thread.
+//Each side owns one index and only reads the other's; a full ring holds the producer back
+typedef struct stream_ring
+{
+  //set up before the thread starts, then only read
+  instruction_t *slots;
+  unsigned size;                  //a power of two
+  char shared_pad[64];            //keeps each side's fields on cache lines of their own
+
+  //written by the consumer only
+  unsigned head;                  //next slot the consumer takes
+  counter_t consumer_waits;       //times it was empty
+  char consumer_pad[64];
+
+  //written by the producer only
+  unsigned tail;                  //next slot the producer fills
+  int ended;                      //set once the last instruction is in
+  counter_t producer_waits;       //times the ring was full
+  char producer_pad[64];
+}stream_ring_t;
+
+static stream_ring_t *stream_ring = NULL;
+static pthread_t stream_thread;
+
+//next cycle the streaming machine has to simulate
+static int stream_next_cycle(tom_machine_t *m) {
+  if (m->cycle == 0)
+    return 1;
+  if (!tom_skip_cycles)
+    return m->cycle + 1;
+
+  int next = stream_fns->next_event_cycle(m, m->cycle);
+  if (next == INT_MAX)
+    panic("Tomasulo deadlock at cycle %d: no stage can make progress", m->cycle);
+  return next;
+}
+
+//simulates the next cycle of the streaming machine
+static void stream_step(tom_machine_t *m) {
+  int cycle = stream_next_cycle(m);
+
+  if (m->progress && cycle % 100 == 0) printf("Cycle #: %d \n", cycle);
+  stream_fns->simulate_cycle(m, cycle);
+}
+
+//drops the instructions that have left the machine from the front of the window, in order
+static void stream_flush(tom_machine_t *m) {
+  int start = m->flush_index;
+
+  while (m->flush_index < m->fetch_index) {
+    //fetch jumps over skipped instructions, so they never get marked
+    uint8_t *retired = &m->retired[m->flush_index & (m->retired_size - 1)];
+    if (!*retired && get_instr_hot(m->trace, m->flush_index)->cls != INSTR_CLASS_SKIP)
+      break;
+    *retired = 0;
+
+    //index 0 is the dummy instruction at the head of every trace
+    if (m->print_table && m->flush_index > 0)
+      print_tom_instr(get_instr(m->trace, m->flush_index));
+    if (m->pipeview && m->flush_index > 0)
+      tom_pipeview_instr(m->pipeview, get_instr(m->trace, m->flush_index));
+    m->flush_index++;
+  }
+
+  if ((start >> INSTR_TRACE_SHIFT) != (m->flush_index >> INSTR_TRACE_SHIFT))
+    release_instr(m->trace, m->flush_index);
+}
+
+//makes room in the retired ring for every instruction up to the index
+static void stream_reserve(tom_machine_t *m, int index) {
+  if (index - m->flush_index < m->retired_size)
+    return;
+
+  int size = m->retired_size;
+  while (index - m->flush_index >= size)
+    size *= 2;
+
+  uint8_t *retired = calloc(size, 1);
+  if (!retired)
+    fatal("out of virtual memory");
+
+  int i;
+  for (i = m->flush_index; i < m->flush_index + m->retired_size; i++)
+    retired[i & (size - 1)] = m->retired[i & (m->retired_size - 1)];
+
+  free(m->retired);
+  m->retired = retired;
+  m->retired_size = size;
+}
+
+static void stream_put(tom_machine_t *m, instruction_t* instr);
+
+//streaming thread: feeds the machine with the instructions of the ring until it is ended
+static void *stream_worker(void *arg) {
+  stream_ring_t *ring = arg;
+  unsigned head = ring->head;
+
+  for (;;) {
+    unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+      //ended is set after the last tail, so once it is seen the tail is final
+      if (__atomic_load_n(&ring->ended, __ATOMIC_ACQUIRE)
+          && head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        return NULL;
+      ring->consumer_waits++;
+      sched_yield();
+      continue;
+    }
+    for (; head != tail; head++) {
+      stream_put(stream_machine, &ring->slots[head & (ring->size - 1)]);
+      __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    }
+  }
+}
+
+//queues an instruction for the streaming thread, waiting while the ring is full
+static void stream_ring_push(stream_ring_t *ring, const instruction_t* instr) {
+  unsigned tail = ring->tail;
+
+  while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->size) {
+    ring->producer_waits++;
+    sched_yield();
+  }
+  ring->slots[tail & (ring->size - 1)] = *instr;
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Description:
+ * 	Starts a streaming run: instead of building the whole trace and calling runTomasulo,
+ *      the functional simulator hands every instruction to tomasulo_stream_put as soon as it
+ *      is produced. The machine only keeps the instructions between the oldest one still in
+ *      flight and the newest one produced, so memory does not grow with the length of the run.
+ *      The cycle counts are the same as simulating the whole trace.
+ * Inputs:
+ *      print_table: print each instruction's row of the Tomasulo table once it is final
+ * Returns:
+ * 	None
+ */
+void tomasulo_stream_begin(int print_table) {
+  setup_machine_config();
+  if (needs_whole_trace())
+    fatal("-tom:check_skip, -tom:check_ref, -tom:sweep, sampled and parallel simulation need the "
+          "whole trace; they cannot stream");
+
+  instruction_trace_t *trace = calloc(1, sizeof(instruction_trace_t));
+  if (!trace)
+    fatal("out of virtual memory");
+
+  tom_machine_t *m = create_machine(&machine_config, trace, -1);
+  m->writeback = true;
+  m->progress = tomasulo_progress;
+  m->streaming = true;
+  m->print_table = print_table && instr_table_format != INSTR_TABLE_NONE;
+  m->stream_fetchable = 0;
+  m->retired_size = 1024;
+  attach_occupancy(m);
+  m->retired = calloc(m->retired_size, 1);
+  if (!m->retired)
+    fatal("out of virtual memory");
+
+  m->pipeview = open_pipeview();
+
+  if (m->print_table)
+    open_instr_table();
+  stream_machine = m;
+  stream_fns = select_machine(m->cfg);
+
+  if (stream_threaded) {
+    stream_ring = calloc(1, sizeof(stream_ring_t));
+    if (!stream_ring)
+      fatal("out of virtual memory");
+    stream_ring->size = stream_ring_size;
+    stream_ring->slots = malloc(stream_ring_size * sizeof(instruction_t));
+    if (!stream_ring->slots)
+      fatal("out of virtual memory");
+    if (pthread_create(&stream_thread, NULL, stream_worker, stream_ring) != 0)
+      fatal("could not start the streaming thread");
+  }
+}
+
+/*
+ * Description:
+ * 	Adds the next instruction of the trace (in order, starting with the dummy at index 0)
+ *      and simulates every cycle that no longer depends on instructions not produced yet.
+ *      With -tom:stream_thread, the instruction is only queued for the streaming thread.
+ * Inputs:
+ *      instr: the instruction; it is copied
+ * Returns:
+ * 	None
+ */
+void tomasulo_stream_put(instruction_t* instr) {
+  assert(stream_machine != NULL);
+  if (stream_ring)
+    stream_ring_push(stream_ring, instr);
+  else
+    stream_put(stream_machine, instr);
+}
+
+//adds an instruction to the streaming machine and simulates what it makes possible
+static void stream_put(tom_machine_t *m, instruction_t* instr) {
+  assert(instr->index == m->trace->total_size);
+
+  stream_reserve(m, instr->index);
+  put_instr(m->trace, instr);
+
+  //only the next instruction tells whether a branch was taken, so the newest instruction
+  //cannot be fetched until another one follows it
+  m->num_insn = instr->index - 1;
+  if (instr->index > 0 && get_instr_hot(m->trace, instr->index - 1)->cls != INSTR_CLASS_SKIP)
+    m->stream_fetchable++;
+
+  //a cycle can only be simulated once every instruction its fetch takes has been produced
+  while (m->stream_fetchable - m->fetch_count
+         >= MIN(m->cfg->fetch_width, m->cfg->ifq_size - m->instr_queue_size)) {
+    stream_step(m);
+    stream_flush(m);
+  }
+}
+
+/*
+ * Description:
+ * 	Ends a streaming run: drains the machine once the last instruction has been put
+ * Inputs:
+ * 	None
+ * Returns:
+ * 	The total number of cycles it takes to execute the instructions.
+ */
+counter_t tomasulo_stream_end(void) {
+  tom_machine_t *m = stream_machine;
+  assert(m != NULL);
+
+  if (stream_ring) {
+    __atomic_store_n(&stream_ring->ended, 1, __ATOMIC_RELEASE);
+    pthread_join(stream_thread, NULL);
+    fprintf(stderr, "streaming thread: the functional simulator waited on a full ring %lld times, "
+            "the machine on an empty one %lld times\n", (long long)stream_ring->producer_waits,
+            (long long)stream_ring->consumer_waits);
+    free(stream_ring->slots);
+    free(stream_ring);
+    stream_ring = NULL;
+  }
+
+  m->num_insn = m->trace->total_size - 1;
+  do {
+    stream_step(m);
+    stream_flush(m);
+  } while (!is_simulation_done(m, m->num_insn));
+
+  counter_t cycles = m->cycle + 1;
+  report_machine(m);
+  close_instr_record();
+  if (m->print_table)
+    close_instr_table();
+  if (m->pipeview)
+    tom_pipeview_close(m->pipeview);
+
+  free_instr_trace(m->trace);
+  destroy_machine(m);
+  stream_machine = NULL;
+  return cycles;
+}
+
+/* CONFIGURATION SWEEPS */
+
+//one machine configuration of a sweep and its result
+typedef struct sweep_point
+{
+  tom_config_t cfg;
+  tom_machine_t *machine;
+  counter_t cycles;
+}sweep_point_t;
+
+//work shared by the sweep threads
+typedef struct sweep_job
+{
+  sweep_point_t *points;
+  int num_points;
+  int next_point;  //next configuration to hand out (taken atomically)
+}sweep_job_t;
+
+//sweep thread: simulates configurations until there are none left
+static void *sweep_worker(void *arg) {
+  sweep_job_t *job = arg;
+  int p;
+
+  while ((p = __sync_fetch_and_add(&job->next_point, 1)) < job->num_points) {
+    job->points[p].cycles = run_machine(job->points[p].machine);
+  }
+  return NULL;
+}
+
+//applies "name=value,name=value" overrides from a sweep spec on top of the base config
+static void parse_sweep_spec(const char *spec, tom_config_t *cfg) {
+  char *copy = mystrdup((char *)spec);
+  char *save = NULL;
+  char *field;
+
+  for (field = strtok_r(copy, ",", &save); field; field = strtok_r(NULL, ",", &save)) {
+    char name[32];
+    char text[32];
+    if (sscanf(field, "%31[^=]=%31s", name, text) != 2)
+      fatal("bad sweep field `%s' in `%s' (expected name=value)", field, spec);
+    int value = atoi(text);
+
+    if (!strcmp(name, "ifq_size")) cfg->ifq_size = value;
+    else if (!strcmp(name, "rs_int")) cfg->rs_int_size = value;
+    else if (!strcmp(name, "rs_fp")) cfg->rs_fp_size = value;
+    else if (!strcmp(name, "fetch_width")) cfg->fetch_width = value;
+    else if (!strcmp(name, "dispatch_width")) cfg->dispatch_width = value;
+    else if (!strcmp(name, "cdbs")) cfg->num_cdb = value;
+    else if (!strcmp(name, "lsq")) cfg->lsq_size = value;
+    else if (!strcmp(name, "lsq_fwd_lat")) cfg->lsq_fwd_latency = value;
+    else if (!strcmp(name, "rob")) cfg->rob_size = value;
+    else if (!strcmp(name, "prf")) cfg->prf_size = value;
+    else if (!strcmp(name, "bpred_bits")) cfg->bpred_bits = value;
+    else if (!strcmp(name, "bpred_penalty")) cfg->bpred_penalty = value;
+    else if (!strcmp(name, "bpred")) {
+      cfg->bpred = tom_bpred_lookup(text);
+      if (cfg->bpred == -1)
+        fatal("unknown branch predictor `%s' in `%s'", text, spec);
+    }
+    else {
+      //functional unit and cache parameters are named like their options, without "-tom:"
+      int p;
+      for (p = 0; p < NUM_FU_POOLS; p++) {
+        if (!strcmp(name, fu_pools[p].count_opt + 5)) { cfg->fu[p].count = value; break; }
+        if (!strcmp(name, fu_pools[p].latency_opt + 5)) { cfg->fu[p].latency = value; break; }
+        if (!strcmp(name, fu_pools[p].interval_opt + 5)) { cfg->fu[p].interval = value; break; }
+      }
+      if (p < NUM_FU_POOLS)
+        continue;
+      for (p = 0; p < NUM_CACHE_PARAMS; p++) {
+        if (!strcmp(name, cache_params[p].opt + 5)) { *CACHE_PARAM(cfg, p) = value; break; }
+      }
+      if (p == NUM_CACHE_PARAMS)
+        fatal("unknown sweep parameter `%s' in `%s'", name, spec);
+    }
+  }
+  free(copy);
+  check_config(cfg);
+}
+
+/*
+ * Description:
+ * 	Simulates the base configuration and every -tom:sweep configuration over the same
+ *      trace, one independent machine per configuration, spread over -tom:sweep_threads
+ *      threads. Only the base configuration writes its timing into the trace.
+ * Inputs:
+ *      trace: instruction trace with all the instructions executed
+ * Returns:
+ * 	The total number of cycles the base configuration takes.
+ */
+static counter_t run_sweep(instruction_trace_t* trace) {
+  int num_points = sweep_num_specs + 1;
+  sweep_point_t *points = calloc(num_points, sizeof(sweep_point_t));
+  int i;
+  if (!points)
+    fatal("out of virtual memory");
+
+  //a point that turns the L1D on gets the cache defaults for the parameters it does not set
+  tom_config_t cache_defaults = machine_config;
+  if (cache_defaults.cache.l1d_kb == 0) {
+    for (i = 0; i < NUM_CACHE_PARAMS; i++)
+      *CACHE_PARAM(&cache_defaults, i) = cache_params[i].def;
+  }
+
+  for (i = 0; i < num_points; i++) {
+    points[i].cfg = i > 0 ? cache_defaults : machine_config;
+    if (i > 0) {
+      parse_sweep_spec(sweep_specs[i - 1], &points[i].cfg);
+      normalize_config(&points[i].cfg);
+    }
+    points[i].machine = create_machine(&points[i].cfg, trace, sim_num_insn);
+  }
+  points[0].machine->writeback = true;
+  attach_occupancy(points[0].machine);
+
+  sweep_job_t job = { points, num_points, 0 };
+  int num_threads = MIN(sweep_threads, num_points);
+  pthread_t *threads = calloc((size_t)num_threads, sizeof(pthread_t));
+  if (!threads)
+    fatal("out of virtual memory");
+
+  for (i = 0; i < num_threads; i++) {
+    if (pthread_create(&threads[i], NULL, sweep_worker, &job) != 0)
+      fatal("could not start sweep thread %d", i);
+  }
+  for (i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  fprintf(stderr, "\nTomasulo sweep: %d configurations on %d threads, %lld instructions\n",
+          num_points, num_threads, (long long)sim_num_insn);
+  fprintf(stderr, "%8s %6s %5s %5s %5s %4s %4s %4s %4s %-10s %-7s %-7s %12s %8s  %s\n",
+          "ifq_size", "rs_int", "rs_fp", "fetch", "disp", "cdbs", "lsq", "rob", "prf", "bpred",
+          "l1d", "l2", "cycles", "CPI",
+          "functional units (units x latency / interval)");
+  for (i = 0; i < num_points; i++) {
+    const tom_config_t *cfg = &points[i].cfg;
+    char units[256] = "";
+    int p;
+    for (p = 0; p < NUM_FU_POOLS; p++) {
+      const tom_fu_pool_t *fu = &cfg->fu[p];
+      int len = strlen(units);
+      if (fu->count && fu->interval)
+        snprintf(units + len, sizeof(units) - len, " %s:%dx%d/%d", fu_pools[p].name,
+                 fu->count, fu->latency, fu->interval);
+      else if (fu->count)
+        snprintf(units + len, sizeof(units) - len, " %s:%dx%d", fu_pools[p].name,
+                 fu->count, fu->latency);
+    }
+    char bpred[32];
+    if (cfg->bpred == BPRED_PERFECT)
+      snprintf(bpred, sizeof(bpred), "%s", tom_bpred_name(cfg->bpred));
+    else
+      snprintf(bpred, sizeof(bpred), "%s/%d", tom_bpred_name(cfg->bpred), cfg->bpred_bits);
+    //caches as size/associativity
+    char l1d[16] = "-";
+    char l2[16] = "-";
+    if (cfg->cache.l1d_kb)
+      snprintf(l1d, sizeof(l1d), "%dK/%d", cfg->cache.l1d_kb, cfg->cache.l1d_assoc);
+    if (cfg->cache.l1d_kb && cfg->cache.l2_kb)
+      snprintf(l2, sizeof(l2), "%dK/%d", cfg->cache.l2_kb, cfg->cache.l2_assoc);
+    fprintf(stderr, "%8d %6d %5d %5d %5d %4d %4d %4d %4d %-10s %-7s %-7s %12lld %8.4f %s\n",
+            cfg->ifq_size, cfg->rs_int_size, cfg->rs_fp_size, cfg->fetch_width,
+            cfg->dispatch_width, cfg->num_cdb, cfg->lsq_size, cfg->rob_size, cfg->prf_size,
+            bpred, l1d, l2,
+            (long long)points[i].cycles,
+            sim_num_insn ? (double)points[i].cycles / sim_num_insn : 0.0, units);
+  }
+
+  counter_t cycles = points[0].cycles;
+  report_machine(points[0].machine);
+  for (i = 0; i < num_points; i++) {
+    destroy_machine(points[i].machine);
+  }
+  free(threads);
+  free(points);
+  return cycles;
+}
+
+//registers the Tomasulo simulation options with the simulator
+void tomasulo_reg_options(struct opt_odb_t *odb) {
+  opt_reg_int(odb, "-tom:ifq_size", "instruction queue entries",
+              &machine_config.ifq_size, /* default */INSTR_QUEUE_SIZE,
+              /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:rs_int", "INT reservation station entries",
+              &machine_config.rs_int_size, /* default */RESERV_INT_SIZE,
+              /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:rs_fp", "FP reservation station entries",
+              &machine_config.rs_fp_size, /* default */RESERV_FP_SIZE,
+              /* print */TRUE, /* format */NULL);
+  int p;
+  for (p = 0; p < NUM_FU_POOLS; p++) {
+    const fu_pool_desc_t *desc = &fu_pools[p];
+    tom_fu_pool_t *fu = &machine_config.fu[p];
+    opt_reg_int(odb, (char *)desc->count_opt,
+                desc->base == p ? "functional units of the type"
+                                : "functional units of the type (0: run on the INT/FP units)",
+                &fu->count, /* default */desc->defaults.count,
+                /* print */TRUE, /* format */NULL);
+    opt_reg_int(odb, (char *)desc->latency_opt, "latency of the type's opcodes (cycles)",
+                &fu->latency, /* default */desc->defaults.latency,
+                /* print */TRUE, /* format */NULL);
+    opt_reg_int(odb, (char *)desc->interval_opt,
+                "cycles between instructions entering a unit of the type (0: unpipelined)",
+                &fu->interval, /* default */desc->defaults.interval,
+                /* print */TRUE, /* format */NULL);
+  }
+  opt_reg_string_list(odb, "-tom:op_lat",
+                      "per-opcode latencies overriding their unit's, each opcode=cycles "
+                      "(e.g. mult=6)",
+                      op_lat_specs, OP_LAT_MAX_SPECS, &op_lat_num_specs, NULL,
+                      /* print */TRUE, /* format */NULL, /* accrue */TRUE);
+  opt_reg_int(odb, "-tom:fetch_width", "instructions fetched per cycle",
+              &machine_config.fetch_width, /* default */FETCH_WIDTH,
+              /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:dispatch_width", "instructions dispatched per cycle",
+              &machine_config.dispatch_width, /* default */DISPATCH_WIDTH,
+              /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:cdbs", "common data buses",
+              &machine_config.num_cdb, /* default */CDB_COUNT,
+              /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:lsq", "load/store queue entries (0: loads and stores are only "
+              "ordered through registers)", &machine_config.lsq_size, /* default */LSQ_SIZE,
+              /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:lsq_fwd_lat", "latency of a load forwarded from a store (cycles)",
+              &machine_config.lsq_fwd_latency, /* default */LSQ_FWD_LATENCY,
+              /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:rob", "reorder buffer entries (0: instructions leave from the CDB)",
+              &machine_config.rob_size, /* default */ROB_SIZE,
+              /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:prf", "physical registers, architectural ones included; dispatch "
+              "stalls when none is free for a destination (0: no limit)",
+              &machine_config.prf_size, /* default */PRF_SIZE, /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-tom:bpred", "branch predictor {perfect|bimodal|gshare|tage}",
+                 &bpred_option, /* default */BPRED_KIND, /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:bpred_bits", "log2 of the entries in each branch predictor table",
+              &machine_config.bpred_bits, /* default */BPRED_BITS,
+              /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:bpred_penalty", "cycles from a mispredicted branch resolving "
+              "to fetch restarting", &machine_config.bpred_penalty, /* default */BPRED_PENALTY,
+              /* print */TRUE, /* format */NULL);
+  int i;
+  for (i = 0; i < NUM_CACHE_PARAMS; i++) {
+    opt_reg_int(odb, (char *)cache_params[i].opt, (char *)cache_params[i].desc,
+                CACHE_PARAM(&machine_config, i), /* default */cache_params[i].def,
+                /* print */TRUE, /* format */NULL);
+  }
+
+  opt_reg_flag(odb, "-tom:skip", "skip cycles in which no stage can change state",
+               &tom_skip_cycles, /* default */TRUE, /* print */TRUE, /* format */NULL);
+  opt_reg_flag(odb, "-tom:check_skip", "check cycle skipping against the per-cycle loop",
+               &tom_check_skip, /* default */FALSE, /* print */TRUE, /* format */NULL);
+  opt_reg_flag(odb, "-tom:check_ref", "check every instruction's timing against a simple "
+               "reference model", &tom_check_ref, /* default */FALSE, /* print */TRUE, /* format */NULL);
+  opt_reg_flag(odb, "-tom:progress", "print the cycle every 100 cycles",
+               &tomasulo_progress, /* default */TRUE, /* print */TRUE, /* format */NULL);
+  opt_reg_flag(odb, "-tom:stream_thread", "when streaming, simulate on a thread of its own while "
+               "the functional simulator runs", &stream_threaded, /* default */FALSE,
+               /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:stream_ring", "instructions the functional simulator can run ahead of "
+              "the streaming thread (a power of two)", &stream_ring_size, /* default */4096,
+              /* print */TRUE, /* format */NULL);
+
+  opt_reg_int(odb, "-tom:simpoint", "simulate a sample of intervals of this many instructions "
+              "and extrapolate (0: simulate the whole trace)", &simpoint_interval, /* default */0,
+              /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:simpoint_k", "most clusters of intervals", &simpoint_max_k,
+              /* default */10, /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:simpoint_samples", "intervals simulated per cluster (2 or more give "
+              "an error bound)", &simpoint_per_cluster, /* default */2, /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:simpoint_warmup", "instructions simulated in detail before each interval",
+              &simpoint_warmup, /* default */10000, /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:simpoint_seed", "seed of the clustering and the picks",
+              &simpoint_seed, /* default */1, /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-tom:simpoint_ckpt", "write the machine at the start of every sampled "
+                 "interval to this prefix, followed by the interval number", &simpoint_ckpt_prefix,
+                 /* default */NULL, /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-tom:simpoint_restore", "simulate the interval of this checkpoint on its own",
+                 &simpoint_restore_path, /* default */NULL, /* print */TRUE, /* format */NULL);
+
+  opt_reg_int(odb, "-tom:parallel", "simulate this many chunks of the trace on -tom:sweep_threads "
+              "threads and add up their cycles (0: simulate it serially)", &parallel_chunks, /* default */0,
+              /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:parallel_warmup", "instructions before each chunk it is warmed up on",
+              &parallel_warmup, /* default */10000, /* print */TRUE, /* format */NULL);
+  opt_reg_flag(odb, "-tom:parallel_check", "also run serially and report the error of each chunk",
+               &parallel_check, /* default */FALSE, /* print */TRUE, /* format */NULL);
+
+  opt_reg_string_list(odb, "-tom:sweep",
+                      "extra configurations to simulate over the same trace, each a list of "
+                      "name=value overrides (e.g. rs_int=16,fu_int=4)",
+                      sweep_specs, SWEEP_MAX_CONFIGS, &sweep_num_specs, NULL,
+                      /* print */TRUE, /* format */NULL, /* accrue */TRUE);
+  opt_reg_int(odb, "-tom:sweep_threads", "threads simulating the sweep configurations "
+              "or the -tom:parallel chunks",
+              &sweep_threads, /* default */1, /* print */TRUE, /* format */NULL);
+
+  opt_reg_flag(odb, "-tom:occupancy", "keep histograms of how many entries of each structure "
+               "are in use", &tom_occupancy, /* default */FALSE, /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-tom:occ_out", "write the average occupancy of every structure over "
+                 "each -tom:occ_interval cycles to this file (CSV, or binary with -tom:occ_binary)",
+                 &occ_out_path, /* default */NULL, /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-tom:occ_interval", "cycles per row of the occupancy time series",
+              &occ_interval, /* default */10000, /* print */TRUE, /* format */NULL);
+  opt_reg_flag(odb, "-tom:occ_binary", "write the occupancy time series in binary",
+               &occ_binary, /* default */FALSE, /* print */TRUE, /* format */NULL);
+
+  opt_reg_string(odb, "-tom:table", "how the Tomasulo table is printed {text|binary|none}",
+                 &table_option, /* default */"text", /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-tom:table_out", "print the Tomasulo table to this file instead of stdout",
+                 &instr_table_path, /* default */NULL, /* print */TRUE, /* format */NULL);
+  opt_reg_int_list(odb, "-tom:table_insts", "only print the instructions with indices from "
+                   "the first to the last value", table_insts, 2, &table_num_insts, NULL,
+                   /* print */TRUE, /* format */NULL, /* accrue */FALSE);
+  opt_reg_int(odb, "-tom:table_sample", "print one instruction in this many",
+              &instr_table_sample, /* default */1, /* print */TRUE, /* format */NULL);
+  opt_reg_flag(odb, "-tom:table_disasm_cache", "disassemble each pc once for the table",
+               &instr_table_disasm_cache, /* default */TRUE, /* print */TRUE, /* format */NULL);
+
+  opt_reg_string(odb, "-tom:pipe_out", "export every instruction's stages to this file, "
+                 "for a pipeline viewer", &pipe_out_path, /* default */NULL,
+                 /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-tom:pipe_format", "pipeline viewer format {konata|chrome}",
+                 &pipe_format_option, /* default */"konata", /* print */TRUE, /* format */NULL);
+  opt_reg_int_list(odb, "-tom:pipe_insts", "only export the instructions with indices from "
+                   "the first to the last value", pipe_insts, 2, &pipe_num_insts, NULL,
+                   /* print */TRUE, /* format */NULL, /* accrue */FALSE);
+  opt_reg_int_list(odb, "-tom:pipe_cycles", "only export the instructions in flight between "
+                   "the first and the last cycle", pipe_cycles, 2, &pipe_num_cycles, NULL,
+                   /* print */TRUE, /* format */NULL, /* accrue */FALSE);
+
+  opt_reg_string(odb, "-tom:trace_out", "record the instruction trace to this file",
+                 &instr_record_path, /* default */NULL, /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-tom:trace_in", "replay the instruction trace from this file "
+                 "instead of simulating the program", &trace_in_path, /* default */NULL,
+                 /* print */TRUE, /* format */NULL);
+}
+
+//names and descriptions of the stall statistics, by cause
+static const char *fetch_stall_stats[NUM_FETCH_STALLS][2] = {
+  { "tom_fetch_ifq_full", "cycles fetch stalled on a full instruction queue" },
+  { "tom_fetch_redirect", "cycles fetch waited for a mispredicted branch to resolve" },
+};
+static const char *dispatch_stall_stats[NUM_DISPATCH_STALLS][2] = {
+  { "tom_dispatch_ifq_empty", "cycles dispatch found the instruction queue empty" },
+  { "tom_dispatch_rs_int_full", "cycles dispatch stalled on a full INT reservation station" },
+  { "tom_dispatch_rs_fp_full", "cycles dispatch stalled on a full FP reservation station" },
+  { "tom_dispatch_lsq_full", "cycles dispatch stalled on a full load/store queue" },
+  { "tom_dispatch_rob_full", "cycles dispatch stalled on a full reorder buffer" },
+  { "tom_dispatch_prf_empty", "cycles dispatch stalled with no free physical register" },
+};
+static const char *execute_stall_stats[NUM_EXECUTE_STALLS][2] = {
+  { "tom_execute_operands", "cycles issued instructions waited for their operands" },
+  { "tom_execute_fu_busy", "cycles ready instructions waited for a functional unit (or an older store)" },
+};
+static const char *cpi_stats[NUM_CPI_COMPONENTS][2] = {
+  { "base", "dispatching" },
+  { "frontend", "nothing fetched yet" },
+  { "branch", "behind a mispredicted branch" },
+  { "operands", "oldest instruction waiting for operands" },
+  { "fu_busy", "oldest instruction waiting for a functional unit" },
+  { "execute", "oldest instruction executing" },
+  { "cdb", "oldest instruction writing back on a CDB or waiting for one" },
+  { "commit", "oldest instruction waiting to commit" },
+  { "drain", "draining the machine after the last dispatch" },
+};
+
+//registers the Tomasulo statistics with the simulator; they hold the last run's counts
+void tomasulo_reg_stats(struct stat_sdb_t *sdb) {
+  stat_reg_counter(sdb, "tom_loads_forwarded", "loads that took their data from an older store",
+                   &tom_stats.loads_forwarded, /* initial value */0, /* format */NULL);
+  stat_reg_counter(sdb, "tom_loads_bypassed", "loads that executed ahead of older stores "
+                   "to other addresses", &tom_stats.loads_bypassed, /* initial value */0,
+                   /* format */NULL);
+  stat_reg_counter(sdb, "tom_loads_stalled", "loads held back by an older store to the same word",
+                   &tom_stats.loads_stalled, /* initial value */0, /* format */NULL);
+  stat_reg_counter(sdb, "tom_cond_branches", "conditional branches fetched",
+                   &tom_stats.cond_branches, /* initial value */0, /* format */NULL);
+  stat_reg_counter(sdb, "tom_mispredicts", "conditional branches mispredicted",
+                   &tom_stats.mispredicts, /* initial value */0, /* format */NULL);
+  stat_reg_formula(sdb, "tom_mispredict_rate", "fraction of conditional branches mispredicted",
+                   "tom_mispredicts / tom_cond_branches", /* format */NULL);
+
+  tom_cache_stats_t *cache = &tom_stats.cache;
+  stat_reg_counter(sdb, "tom_l1d_accesses", "loads and stores that accessed the L1 data cache",
+                   &cache->l1d_accesses, /* initial value */0, /* format */NULL);
+  stat_reg_counter(sdb, "tom_l1d_hits", "L1 data cache hits",
+                   &cache->l1d_hits, /* initial value */0, /* format */NULL);
+  stat_reg_formula(sdb, "tom_l1d_hit_rate", "L1 data cache hit rate",
+                   "tom_l1d_hits / tom_l1d_accesses", /* format */NULL);
+  stat_reg_counter(sdb, "tom_l2_accesses", "L1 data cache misses that accessed the L2",
+                   &cache->l2_accesses, /* initial value */0, /* format */NULL);
+  stat_reg_counter(sdb, "tom_l2_hits", "L2 cache hits",
+                   &cache->l2_hits, /* initial value */0, /* format */NULL);
+  stat_reg_formula(sdb, "tom_l2_hit_rate", "L2 cache hit rate",
+                   "tom_l2_hits / tom_l2_accesses", /* format */NULL);
+  stat_reg_counter(sdb, "tom_mshr_merges", "load misses to a line already being fetched",
+                   &cache->mshr_merges, /* initial value */0, /* format */NULL);
+  stat_reg_counter(sdb, "tom_mshr_full", "load misses that waited for a free MSHR",
+                   &cache->mshr_full, /* initial value */0, /* format */NULL);
+  stat_reg_counter(sdb, "tom_mshr_full_cycles", "cycles load misses waited for a free MSHR",
+                   &cache->mshr_full_cycles, /* initial value */0, /* format */NULL);
+
+  int i;
+  for (i = 0; i < NUM_FETCH_STALLS; i++)
+    stat_reg_counter(sdb, (char *)fetch_stall_stats[i][0], (char *)fetch_stall_stats[i][1],
+                     &tom_stats.fetch_stalls[i], /* initial value */0, /* format */NULL);
+  for (i = 0; i < NUM_DISPATCH_STALLS; i++)
+    stat_reg_counter(sdb, (char *)dispatch_stall_stats[i][0], (char *)dispatch_stall_stats[i][1],
+                     &tom_stats.dispatch_stalls[i], /* initial value */0, /* format */NULL);
+  for (i = 0; i < NUM_EXECUTE_STALLS; i++)
+    stat_reg_counter(sdb, (char *)execute_stall_stats[i][0], (char *)execute_stall_stats[i][1],
+                     &tom_stats.execute_stalls[i], /* initial value */0, /* format */NULL);
+  stat_reg_counter(sdb, "tom_cdb_lost", "cycles finished instructions waited for a free CDB",
+                   &tom_stats.cdb_lost, /* initial value */0, /* format */NULL);
+
+  //the CPI stack: cycles per component, and their share of the CPI
+  for (i = 0; i < NUM_CPI_COMPONENTS; i++) {
+    char name[64];
+    char desc[128];
+    char formula[128];
+    snprintf(name, sizeof(name), "tom_cycles_%s", cpi_stats[i][0]);
+    snprintf(desc, sizeof(desc), "cycles spent %s", cpi_stats[i][1]);
+    stat_reg_counter(sdb, name, desc, &tom_stats.cpi[i], /* initial value */0, /* format */NULL);
+    snprintf(formula, sizeof(formula), "tom_cycles_%s / sim_num_insn", cpi_stats[i][0]);
+    snprintf(name, sizeof(name), "tom_cpi_%s", cpi_stats[i][0]);
+    snprintf(desc, sizeof(desc), "CPI spent %s", cpi_stats[i][1]);
+    stat_reg_formula(sdb, name, desc, formula, /* format */NULL);
+  }
+
+  //occupancy: cycles spent with each number of entries in use, per structure of the machine
+  //the options configure (they have been processed by now)
+  if (!tom_occupancy && !occ_out_path)
+    return;
+  char names[TOM_OCC_MAX_COLUMNS][16];
+  char descs[TOM_OCC_MAX_COLUMNS][64];
+  occ_num_stats = occupancy_columns(&machine_config, names, descs, occ_capacity);
+  for (i = 0; i < occ_num_stats; i++) {
+    char name[64];
+    char desc[128];
+    snprintf(name, sizeof(name), "tom_occ_%s", names[i]);
+    snprintf(desc, sizeof(desc), "cycles with each number of %s in use", descs[i]);
+    occ_dists[i] = stat_reg_dist(sdb, name, desc, /* initial value */0,
+                                 /* array size */occ_capacity[i] + 1, /* bucket size */1,
+                                 /* print format */PF_COUNT | PF_PDF, /* format */NULL,
+                                 /* index map */NULL, /* print fn */NULL);
+    snprintf(name, sizeof(name), "tom_occ_%s_mean", names[i]);
+    snprintf(desc, sizeof(desc), "average %s in use", descs[i]);
+    stat_reg_double(sdb, name, desc, &occ_means[i], /* initial value */0, /* format */NULL);
+  }
+}
+
+/* 
+ * Description: 
+ * 	Performs a cycle-by-cycle simulation of the 4-stage pipeline
+ * Inputs:
+ *      trace: instruction trace with all the instructions executed
+ * Returns:
+ * 	The total number of cycles it takes to execute the instructions.
+ * Extra Notes:
+ * 	sim_num_insn: the number of instructions in the trace
+ */
+counter_t runTomasulo(instruction_trace_t* trace)
+{
+  setup_machine_config();
+  close_instr_record();
+
+  counter_t cycles;
+  if (tom_check_skip)
+    cycles = run_skip_check(trace);
+  else if (tom_check_ref)
+    cycles = run_ref_check(trace);
+  else if (simpoint_restore_path)
+    cycles = run_checkpoint(trace);
+  else if (simpoint_interval > 0)
+    cycles = run_sampled(trace);
+  else if (parallel_chunks > 0)
+    cycles = run_parallel(trace);
+  else if (sweep_num_specs > 0)
+    cycles = run_sweep(trace);
+  else {
+    tom_machine_t *m = create_machine(&machine_config, trace, sim_num_insn);
+    m->writeback = true;
+    m->progress = tomasulo_progress;
+    attach_occupancy(m);
+    cycles = run_machine(m);
+    report_machine(m);
+    destroy_machine(m);
+  }
+
+  export_pipeview(trace);
+  return cycles;
+}
+
+//true if -tom:trace_in names a trace file to replay
+int tomasulo_replaying(void) {
+  return trace_in_path != NULL;
+}
+
+/*
+ * Description:
+ * 	Replays the -tom:trace_in trace file on the Tomasulo machine. It is streamed through
+ *      the machine, unless a sweep or one of the checks needs the whole trace in memory.
+ * Inputs:
+ *      print_table: print the Tomasulo table of the run
+ * Returns:
+ * 	The total number of cycles it takes to execute the instructions.
+ * Extra Notes:
+ * 	sets sim_num_insn to the number of instructions in the file
+ */
+counter_t tomasulo_replay(int print_table)
+{
+  instr_file_t *file = open_instr_file(trace_in_path);
+  instruction_t instr;
+  counter_t cycles;
+  int i;
+
+  if (instr_file_size(file) == 0)
+    fatal("trace file `%s' holds no instructions", trace_in_path);
+  sim_num_insn = instr_file_size(file) - 1;
+
+  if (needs_whole_trace()) {
+    instruction_trace_t *trace = calloc(1, sizeof(instruction_trace_t));
+    if (!trace)
+      fatal("out of virtual memory");
+
+    for (i = 0; i < instr_file_size(file); i++) {
+      read_instr_file(file, i, &instr);
+      put_instr(trace, &instr);
+    }
+    cycles = runTomasulo(trace);
+    if (print_table)
+      print_all_instr(trace, sim_num_insn);
+    free_instr_trace(trace);
+  }
+  else {
+    tomasulo_stream_begin(print_table);
+    for (i = 0; i < instr_file_size(file); i++) {
+      read_instr_file(file, i, &instr);
+      tomasulo_stream_put(&instr);
+    }
+    cycles = tomasulo_stream_end();
+  }
+
+  close_instr_file(file);
+  return cycles;
 }
@@ -0,0 +1,36 @@
+#ifndef TOMASULO_H
+#define TOMASULO_H
+
+#include "host.h"
+#include "options.h"
+#include "stats.h"
+
+#include "instr.h"
+
+//registers the Tomasulo simulation options; call from sim_reg_options()
+extern void tomasulo_reg_options(struct opt_odb_t *odb);
+
+//registers the Tomasulo statistics; call from sim_reg_stats()
+extern void tomasulo_reg_stats(struct stat_sdb_t *sdb);
+
+//print the cycle every 100 cycles (-tom:progress)
+extern int tomasulo_progress;
+
+//simulates the trace on the Tomasulo machine and returns the number of cycles taken
+extern counter_t runTomasulo(instruction_trace_t* trace);
+
+//streaming mode: instead of building the whole trace for runTomasulo, hand every instruction
+//to tomasulo_stream_put as it is produced (in order, starting with the dummy at index 0,
+//with the fields put_instr asks for, the effective address of loads and stores included),
+//then call tomasulo_stream_end for the number of cycles taken. With -tom:stream_thread the
+//machine runs on a thread of its own, and tomasulo_stream_put only queues the instruction
+extern void tomasulo_stream_begin(int print_table);
+extern void tomasulo_stream_put(instruction_t* instr);
+extern counter_t tomasulo_stream_end(void);
+
+//true if -tom:trace_in names a trace file; sim_main then calls tomasulo_replay instead of
+//running the functional simulator
+extern int tomasulo_replaying(void);
+extern counter_t tomasulo_replay(int print_table);
+
+#endif
@@ -0,0 +1,290 @@
+
+/*
+ * tombench: times the Tomasulo model on its own, without the functional simulator.
+ *
+ * A synthetic trace is generated in memory and run through runTomasulo a few times;
+ * the benchmark reports simulated instructions per second, host nanoseconds per
+ * simulated cycle, the peak resident set and, where the host lets us read the
+ * hardware counters, the cache misses taken per simulated instruction. The generator
+ * is parameterized so that the scheduler can be timed under different kinds of code.
+ * It links against the Tomasulo sources and the SimpleScalar support objects
+ * (machine.o, misc.o, options.o, stats.o, eval.o), but not main.o:
+ *
+ *   tombench [-tom:... options] [-bench:insts N] [-bench:seed S] [-bench:reps R]
+ *            [-bench:chain L] [-bench:fp P] [-bench:branches P] [-bench:loads P]
+ *
+ * With -tom:check_ref, every run also checks the machine against the reference model on the
+ * synthetic trace, which exercises the scheduler on code shapes the lab traces rarely have.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+#include "options.h"
+#include "sim.h"
+
+#include "instr.h"
+#include "tomasulo.h"
+
+//normally defined by the simulator's main.c
+counter_t sim_num_insn = 0;
+
+/* OPTIONS */
+
+static int bench_insts;
+static int bench_seed;
+static int bench_reps;
+
+//shape of the synthetic code: dependency chain length (0: random registers), the share of
+//computation that is FP, and the share of branches and of loads in the trace (percent)
+static int bench_chain;
+static int bench_fp;
+static int bench_branches;
+static int bench_loads;
+
+/* SYNTHETIC TRACE */
+
+//instruction classes the generator draws from, with their share of the trace (percent)
+enum bench_class { B_INT, B_LOAD, B_STORE, B_FP, B_BRANCH, NUM_BENCH_CLASSES };
+static int bench_mix[NUM_BENCH_CLASSES];
+
+//stores are a fixed share of the trace
+#define BENCH_STORES 8
+
+//an opcode of each class, looked up in the target's opcode table
+static enum md_opcode bench_op[NUM_BENCH_CLASSES];
+
+static unsigned int bench_rng;
+
+static unsigned int bench_rand(void) {
+  bench_rng = bench_rng * 1103515245u + 12345u;
+  return bench_rng >> 8;
+}
+
+//first opcode whose flags include all of the given ones
+static enum md_opcode find_op(unsigned int flags) {
+  int op;
+  for (op = 1; op < OP_MAX; op++) {
+    if ((MD_OP_FLAGS(op) & flags) == flags && !(MD_OP_FLAGS(op) & F_TRAP))
+      return op;
+  }
+  fatal("the target has no opcode with flags 0x%x", flags);
+  return OP_NA;
+}
+
+//register in 1..8 of the integer or the floating-point file
+static int bench_reg(int fp) {
+  return (fp ? MD_NUM_IREGS : 0) + 1 + bench_rand() % 8;
+}
+
+//word-aligned address in a 4KB data region, so that loads and stores sometimes meet
+static md_addr_t bench_addr(void) {
+  return 0x10000000 + 8 * (bench_rand() % 512);
+}
+
+//splits the trace between the classes as the options ask; the defaults give 45% INT,
+//15% loads, 8% stores, 20% FP and 12% branches
+static void set_mix(void) {
+  if (bench_chain < 0 || bench_fp < 0 || bench_fp > 100 || bench_branches < 0 || bench_loads < 0
+      || bench_branches + bench_loads + BENCH_STORES > 100)
+    fatal("bad trace shape: the chain length and the percentages cannot be negative, and branches, "
+          "loads and the %d%% of stores cannot exceed 100%%", BENCH_STORES);
+
+  int compute = 100 - bench_branches - bench_loads - BENCH_STORES;
+  bench_mix[B_FP] = compute * bench_fp / 100;
+  bench_mix[B_INT] = compute - bench_mix[B_FP];
+  bench_mix[B_LOAD] = bench_loads;
+  bench_mix[B_STORE] = BENCH_STORES;
+  bench_mix[B_BRANCH] = bench_branches;
+}
+
+//in chains of bench_chain instructions, each reads the result of the one before it (if
+//it has one) in place of its first source, and $0 (which nothing writes) for the others;
+//the first instruction of a chain depends on nothing
+static void chain_sources(instruction_t *instr, int position, int previous_out) {
+  int k;
+  for (k = 0; k < 3; k++) {
+    if (instr->r_in[k] != -1)
+      instr->r_in[k] = 0;
+  }
+  if (position > 0 && previous_out != -1)
+    instr->r_in[0] = previous_out;
+}
+
+//builds a trace of n random instructions, with the dummy at index 0
+static instruction_trace_t *make_trace(int n) {
+  instruction_trace_t *trace = calloc(1, sizeof(instruction_trace_t));
+  instruction_t instr;
+  int previous_out = -1;
+  int i;
+
+  if (!trace)
+    fatal("out of virtual memory");
+
+  memset(&instr, 0, sizeof(instr));
+  instr.r_in[0] = instr.r_in[1] = instr.r_in[2] = -1;
+  instr.r_out[0] = instr.r_out[1] = -1;
+  put_instr(trace, &instr);
+
+  for (i = 1; i <= n; i++) {
+    int pick = bench_rand() % 100;
+    int cls;
+    for (cls = 0; cls < NUM_BENCH_CLASSES - 1 && pick >= bench_mix[cls]; cls++)
+      pick -= bench_mix[cls];
+
+    memset(&instr, 0, sizeof(instr));
+    instr.index = i;
+    instr.op = bench_op[cls];
+    instr.pc = 0x400000 + 8 * i;
+    instr.r_in[0] = instr.r_in[1] = instr.r_in[2] = -1;
+    instr.r_out[0] = instr.r_out[1] = -1;
+
+    switch (cls) {
+    case B_INT:
+      instr.r_in[0] = bench_reg(0);
+      instr.r_in[1] = bench_reg(0);
+      instr.r_out[0] = bench_reg(0);
+      break;
+    case B_LOAD:
+      instr.r_in[0] = bench_reg(0);
+      instr.r_out[0] = bench_reg(bench_rand() % 4 == 0);
+      instr.mem_addr = bench_addr();
+      break;
+    case B_STORE:
+      instr.r_in[0] = bench_reg(bench_rand() % 4 == 0);
+      instr.r_in[1] = bench_reg(0);
+      instr.mem_addr = bench_addr();
+      break;
+    case B_FP:
+      instr.r_in[0] = bench_reg(1);
+      instr.r_in[1] = bench_reg(1);
+      instr.r_out[0] = bench_reg(1);
+      break;
+    case B_BRANCH:
+      instr.r_in[0] = bench_reg(0);
+      instr.r_in[1] = bench_reg(0);
+      break;
+    }
+    if (bench_chain > 0) {
+      chain_sources(&instr, (i - 1) % bench_chain, previous_out);
+      previous_out = instr.r_out[0];
+    }
+    put_instr(trace, &instr);
+  }
+
+  return trace;
+}
+
+/* MEASURING */
+
+//opens a hardware counter of this process, -1 if the host does not provide it
+static int open_counter(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+//stops a counter and reads it into the text of its column; "n/a" if it is not open or the
+//read fails
+static void read_counter(int fd, char *text, size_t size) {
+  uint64_t value;
+  if (fd < 0)
+    return;
+  ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  if (read(fd, &value, sizeof(value)) == (ssize_t)sizeof(value))
+    snprintf(text, size, "%.4f", (double)value / bench_insts);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+  struct opt_odb_t *odb = opt_new(NULL);
+  int rep;
+
+  tomasulo_reg_options(odb);
+  opt_reg_int(odb, "-bench:insts", "instructions in the synthetic trace",
+              &bench_insts, /* default */2000000, /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-bench:seed", "seed of the synthetic trace",
+              &bench_seed, /* default */1, /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-bench:reps", "timed runs over the trace",
+              &bench_reps, /* default */3, /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-bench:chain", "instructions per dependency chain (0: random registers)",
+              &bench_chain, /* default */0, /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-bench:fp", "percent of the computation that is floating point",
+              &bench_fp, /* default */31, /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-bench:branches", "percent of the trace that is conditional branches",
+              &bench_branches, /* default */12, /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-bench:loads", "percent of the trace that is loads",
+              &bench_loads, /* default */15, /* print */TRUE, /* format */NULL);
+  opt_process_options(odb, argc, argv);
+  tomasulo_progress = FALSE;
+  set_mix();
+
+  bench_op[B_INT] = find_op(F_ICOMP);
+  bench_op[B_LOAD] = find_op(F_LOAD);
+  bench_op[B_STORE] = find_op(F_STORE);
+  bench_op[B_FP] = find_op(F_FCOMP);
+  bench_op[B_BRANCH] = find_op(F_COND);
+
+  bench_rng = bench_seed;
+  instruction_trace_t *trace = make_trace(bench_insts);
+  sim_num_insn = bench_insts;
+
+  int llc_misses = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  int l1d_misses = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+
+  fprintf(stderr, "trace: %d instructions, %d%% INT, %d%% FP, %d%% loads, %d%% stores, "
+          "%d%% branches, %s", bench_insts, bench_mix[B_INT], bench_mix[B_FP], bench_mix[B_LOAD],
+          bench_mix[B_STORE], bench_mix[B_BRANCH], bench_chain ? "" : "random registers\n");
+  if (bench_chain)
+    fprintf(stderr, "dependency chains of %d\n", bench_chain);
+  fprintf(stderr, "%4s %12s %10s %14s %10s %14s %14s\n",
+          "run", "cycles", "seconds", "insts/second", "ns/cycle", "L1D miss/inst", "LLC miss/inst");
+  for (rep = 1; rep <= bench_reps; rep++) {
+    char l1d_text[32] = "n/a", llc_text[32] = "n/a";
+
+    if (l1d_misses >= 0) { ioctl(l1d_misses, PERF_EVENT_IOC_RESET, 0); ioctl(l1d_misses, PERF_EVENT_IOC_ENABLE, 0); }
+    if (llc_misses >= 0) { ioctl(llc_misses, PERF_EVENT_IOC_RESET, 0); ioctl(llc_misses, PERF_EVENT_IOC_ENABLE, 0); }
+
+    double start = now();
+    counter_t cycles = runTomasulo(trace);
+    double seconds = now() - start;
+
+    read_counter(l1d_misses, l1d_text, sizeof(l1d_text));
+    read_counter(llc_misses, llc_text, sizeof(llc_text));
+
+    fprintf(stderr, "%4d %12lld %10.3f %14.0f %10.2f %14s %14s\n", rep, (long long)cycles,
+            seconds, bench_insts / seconds, seconds * 1e9 / cycles, l1d_text, llc_text);
+  }
+
+  //the trace and the machine; ru_maxrss is in kilobytes on Linux
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    fprintf(stderr, "peak RSS: %.1f MB\n", usage.ru_maxrss / 1024.0);
+
+  free_instr_trace(trace);
+  return 0;
+}